@@ -0,0 +1,276 @@
+#include <errno.h>
+#include <malloc.h>
+#include <memory.h>
+
+#include "lidManager.h"
+#include "action.h"
+#include "session.h"
+#include "inhibitor.h"
+#include "logind.h"
+#include "recorder.h"
+#include "service.h"
+
+static void action_run(Action* action);
+
+static void action_reply(int error, void* user_data) {
+    Action* action = (Action*) user_data;
+    const gint64 now = latency_now();
+
+    recorder_record(now, RECORDER_REPLY, action->type, error);
+    if (error != -ECANCELED) {
+        latency_record(action->type, LATENCY_REPLY, now - action->call_sent);
+    }
+
+    action_run(action);
+}
+
+static void action_call(Action* action, LogindMethod method, const char* session_path) {
+    action->call_sent = latency_now();
+    latency_record(action->type, LATENCY_CALL, action->call_sent - action->trace.event);
+    recorder_record(action->call_sent, RECORDER_CALL, action->type, method);
+
+    logind_call(action->queue->manager->logind, method, session_path, action->cancellable, action_reply, action);
+}
+
+static void step_lock_session(Action* action) {
+    const char* session_path = action->queue->manager->session->path;
+    if (!session_path) {
+        action_run(action);
+        return;
+    }
+
+    action_call(action, LOGIND_LOCK_SESSION, session_path);
+}
+
+/**
+ * Lock before sleeping unless the sleep delay inhibitor does it on PrepareForSleep, in parallel with the
+ * sleep call.
+ */
+static void step_lock_before_sleep(Action* action) {
+    if (inhibitor_locks_on_sleep(action->queue->manager->inhibitor)) {
+        action_run(action);
+        return;
+    }
+
+    step_lock_session(action);
+}
+
+static void step_suspend(Action* action) {
+    action_call(action, LOGIND_SUSPEND, NULL);
+}
+
+static void step_hibernate(Action* action) {
+    action_call(action, LOGIND_HIBERNATE, NULL);
+}
+
+static void step_suspend_then_hibernate(Action* action) {
+    action_call(action, LOGIND_SUSPEND_THEN_HIBERNATE, NULL);
+}
+
+static void step_power_off(Action* action) {
+    action_call(action, LOGIND_POWER_OFF, NULL);
+}
+
+static const action_step steps_lock[] = { step_lock_session, NULL };
+static const action_step steps_suspend[] = { step_lock_before_sleep, step_suspend, NULL };
+static const action_step steps_shutdown[] = { step_power_off, NULL };
+static const action_step steps_hibernate[] = { step_lock_before_sleep, step_hibernate, NULL };
+static const action_step steps_suspend_then_hibernate[] = {
+        step_lock_before_sleep, step_suspend_then_hibernate, NULL
+};
+
+static const action_step* action_steps(ActionType type) {
+    switch (type) {
+        case ACTION_LOCK:
+            return steps_lock;
+        case ACTION_SUSPEND:
+            return steps_suspend;
+        case ACTION_SHUTDOWN:
+            return steps_shutdown;
+        case ACTION_HIBERNATE:
+            return steps_hibernate;
+        case ACTION_SUSPEND_THEN_HIBERNATE:
+            return steps_suspend_then_hibernate;
+        default:
+            return NULL;
+    }
+}
+
+static void actionQueue_dispatch(ActionQueue* queue) {
+    if (queue->current || !queue->ready) {
+        return;
+    }
+
+    Action* action = g_queue_pop_head(&queue->pending);
+    if (!action) {
+        return;
+    }
+
+    queue->current = action;
+    action_run(action);
+}
+
+static void action_free(Action* action) {
+    g_object_unref(action->cancellable);
+    free(action);
+}
+
+static void action_done(Action* action) {
+    ActionQueue* queue = action->queue;
+
+    if (queue && action->call_sent && !g_cancellable_is_cancelled(action->cancellable)) {
+        queue->last_type = action->type;
+        queue->last_latency = latency_now() - action->trace.event;
+        latency_record(action->type, LATENCY_TOTAL, queue->last_latency);
+
+        if (queue->manager->service) {
+            service_update(queue->manager->service);
+        }
+    }
+
+    action_free(action);
+
+    if (queue) {
+        queue->current = NULL;
+        actionQueue_dispatch(queue);
+    }
+}
+
+/**
+ * Issue the next step of an action, or finish it once all steps have completed or it was cancelled.
+ *
+ * @param action
+ */
+static void action_run(Action* action) {
+    if (!action->queue || g_cancellable_is_cancelled(action->cancellable)) {
+        action_done(action);
+        return;
+    }
+
+    const action_step step = action->steps[action->step];
+    if (!step || !action->queue->manager->connection) {
+        action_done(action);
+        return;
+    }
+
+    action->step++;
+    step(action);
+}
+
+ActionType action_type_from_string(const char* value) {
+    if (strcmp(value, "blank") == 0) {
+        // Blank is treated as lock because there is no "lock"
+        return ACTION_LOCK;
+    } else if (strcmp(value, "suspend") == 0) {
+        return ACTION_SUSPEND;
+    } else if (strcmp(value, "shutdown") == 0) {
+        return ACTION_SHUTDOWN;
+    } else if (strcmp(value, "hibernate") == 0) {
+        return ACTION_HIBERNATE;
+    } else if (strcmp(value, "logout") == 0) {
+        return ACTION_LOGOUT;
+    } else if (strcmp(value, "suspend-then-hibernate") == 0) {
+        return ACTION_SUSPEND_THEN_HIBERNATE;
+    } else if (strcmp(value, "wake") == 0) {
+        return ACTION_WAKE;
+    }
+
+    return ACTION_NOTHING;
+}
+
+const char* action_type_name(ActionType type) {
+    switch (type) {
+        case ACTION_NOTHING:
+            return "nothing";
+        case ACTION_LOCK:
+            return "lock";
+        case ACTION_SUSPEND:
+            return "suspend";
+        case ACTION_SHUTDOWN:
+            return "shutdown";
+        case ACTION_HIBERNATE:
+            return "hibernate";
+        case ACTION_LOGOUT:
+            return "logout";
+        case ACTION_SUSPEND_THEN_HIBERNATE:
+            return "suspend-then-hibernate";
+        case ACTION_WAKE:
+            return "wake";
+        default:
+            return "unknown";
+    }
+}
+
+ActionQueue* actionQueue_new(const struct LidManager* manager) {
+    ActionQueue* queue = malloc(sizeof(ActionQueue));
+    if (!queue) {
+        return NULL;
+    }
+    memset(queue, 0, sizeof(ActionQueue));
+
+    queue->manager = manager;
+    g_queue_init(&queue->pending);
+    queue->current = NULL;
+    queue->ready = false;
+    queue->last_type = ACTION_NOTHING;
+    queue->last_latency = 0;
+
+    return queue;
+}
+
+void actionQueue_push(ActionQueue* queue, ActionType type, const LatencyTrace* trace) {
+    const action_step* steps = action_steps(type);
+    if (!steps) {
+        return;
+    }
+
+    if (!queue->ready) {
+        actionQueue_cancel(queue);
+    }
+
+    Action* action = malloc(sizeof(Action));
+    memset(action, 0, sizeof(Action));
+
+    action->queue = queue;
+    action->type = type;
+    action->steps = steps;
+    action->step = 0;
+    action->cancellable = g_cancellable_new();
+    action->trace = *trace;
+    action->call_sent = 0;
+
+    g_queue_push_tail(&queue->pending, action);
+    actionQueue_dispatch(queue);
+}
+
+/**
+ * Drop every queued action and stop the in-flight one before its next call is issued.
+ *
+ * @param queue
+ */
+void actionQueue_cancel(ActionQueue* queue) {
+    Action* action;
+    while ((action = g_queue_pop_head(&queue->pending))) {
+        action_free(action);
+    }
+
+    if (queue->current) {
+        g_cancellable_cancel(queue->current->cancellable);
+    }
+}
+
+void actionQueue_set_ready(ActionQueue* queue, bool ready) {
+    queue->ready = ready;
+    actionQueue_dispatch(queue);
+}
+
+void actionQueue_close(ActionQueue* queue) {
+    actionQueue_cancel(queue);
+
+    // The in-flight reply still references the action, it is freed once the cancelled call completes
+    if (queue->current) {
+        queue->current->queue = NULL;
+    }
+
+    free(queue);
+}
@@ -0,0 +1,69 @@
+#ifndef SYSTEMD_LID_ACTION_H
+#define SYSTEMD_LID_ACTION_H
+
+#include <stdbool.h>
+#include <gio/gio.h>
+
+#include "lidManager.h"
+#include "latency.h"
+
+#define LOGIND_BUS_NAME "org.freedesktop.login1"
+#define LOGIND_OBJECT_PATH "/org/freedesktop/login1"
+#define LOGIND_MANAGER_INTERFACE "org.freedesktop.login1.Manager"
+#define LOGIND_CALL_TIMEOUT (10 * 1000)
+
+struct Action;
+struct ActionQueue;
+
+typedef enum ActionType {
+    ACTION_NOTHING = 0,
+    ACTION_LOCK,
+    ACTION_SUSPEND,
+    ACTION_SHUTDOWN,
+    ACTION_HIBERNATE,
+    ACTION_LOGOUT,
+    ACTION_SUSPEND_THEN_HIBERNATE,
+    // Lid open only, turns the screen on through the session's idle monitor
+    ACTION_WAKE,
+    ACTION_TYPE_COUNT,
+} ActionType;
+
+typedef void (*action_step)(struct Action* action);
+
+typedef struct Action {
+    struct ActionQueue* queue;
+    ActionType type;
+
+    const action_step* steps;
+    unsigned step;
+
+    GCancellable* cancellable;
+
+    LatencyTrace trace;
+    gint64 call_sent;
+} Action;
+
+typedef struct ActionQueue {
+    const struct LidManager* manager;
+
+    GQueue pending;
+    Action* current;
+
+    // Whether logind and our session are known, until then only the latest decision is kept
+    bool ready;
+
+    // Last action that ran to completion, and its kernel event to last reply latency in ns
+    ActionType last_type;
+    gint64 last_latency;
+} ActionQueue;
+
+ActionType action_type_from_string(const char* value);
+const char* action_type_name(ActionType type);
+
+ActionQueue* actionQueue_new(const struct LidManager* manager);
+void actionQueue_push(ActionQueue* queue, ActionType type, const LatencyTrace* trace);
+void actionQueue_cancel(ActionQueue* queue);
+void actionQueue_set_ready(ActionQueue* queue, bool ready);
+void actionQueue_close(ActionQueue* queue);
+
+#endif //SYSTEMD_LID_ACTION_H
@@ -1,17 +1,95 @@
 #include <dirent.h>
+#include <errno.h>
 #include <malloc.h>
 #include <memory.h>
 #include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
 #include <asm/errno.h>
 #include <linux/input.h>
 #include <linux/input-event-codes.h>
 #include <sys/ioctl.h>
-#include <glib-unix.h>
 
 #include "basic.h"
 #include "lidManager.h"
 #include "button.h"
+#include "switchRegistry.h"
+#include "eventLoop.h"
+#include "latency.h"
+#include "recorder.h"
+#include "wake.h"
+
+// Older kernel headers only provide struct timeval time
+#ifndef input_event_sec
+#define input_event_sec time.tv_sec
+#define input_event_usec time.tv_usec
+#endif
+
+/**
+ * Re-read the switch state from the kernel, used on open and after the event queue overflowed.
+ *
+ * @param button
+ */
+static int button_sync(Button* button) {
+    unsigned long switches[SW_MAX/ULONG_BITS+1] = {};
+
+    if (ioctl(button->fd, EVIOCGSW(sizeof(switches)), switches) < 0) {
+        return -errno;
+    }
+
+    button->lid_closed = bitset_get(switches, SW_LID);
+    button->docked = bitset_get(switches, SW_DOCK);
+    button->frame_lid_closed = button->lid_closed;
+    button->frame_docked = button->docked;
+
+    return 0;
+}
+
+/**
+ * Apply one event to the frame being assembled. Switch changes only become visible on SYN_REPORT, and
+ * everything up to the next SYN_REPORT is discarded after SYN_DROPPED.
+ *
+ * @param button
+ * @param ev
+ */
+static void button_process_event(Button* button, const struct input_event* ev) {
+    if (ev->type == EV_SYN) {
+        if (ev->code == SYN_DROPPED) {
+            button->dropped = true;
+        } else if (ev->code == SYN_REPORT) {
+            const bool lid_closed = button->lid_closed;
+
+            if (button->dropped) {
+                button->dropped = false;
+                button_sync(button);
+            } else {
+                button->lid_closed = button->frame_lid_closed;
+                button->docked = button->frame_docked;
+            }
+            button->frame_time = latency_timeval(ev->input_event_sec, ev->input_event_usec);
+
+            // Ahead of the rest of the batch and of the policy, the screen should be on by the time the lid is up
+            if (lid_closed && !button->lid_closed && button->manager->wake) {
+                wake_lid_opened(button->manager->wake, button->frame_time);
+            } else if (!lid_closed && button->lid_closed && button->manager->wake) {
+                wake_lid_closed(button->manager->wake);
+            }
+        }
+        return;
+    }
+
+    if (button->dropped) {
+        return;
+    }
+
+    if (ev->type == EV_SW) {
+        if (ev->code == SW_LID) {
+            button->frame_lid_closed = (ev->value > 0);
+        } else if (ev->code == SW_DOCK) {
+            button->frame_docked = (ev->value > 0);
+        }
+    }
+}
 
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wunused-parameter"
@@ -19,31 +97,73 @@ static gboolean button_handler(gint fd, GIOCondition condition, void *user_data)
 #pragma clang diagnostic pop
 
     Button* button = (Button*) user_data;
-    struct input_event ev;
+    struct input_event events[BUTTON_EVENT_BATCH];
+    const bool lid_closed = button->lid_closed;
+    const bool docked = button->docked;
+    gint64 read_time = 0;
     ssize_t l;
 
-    l = read(button->fd, &ev, sizeof(ev));
-    if (l == 0) {
-        return 0;
-    }
-    if (l < sizeof(ev)) {
-        return 0;
-    }
+    do {
+        l = read(button->fd, events, sizeof(events));
+        if (!read_time) {
+            read_time = latency_now();
+        }
+        if (l < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                break;
+            }
+            button->event_monitor = 0;
+            return FALSE;
+        }
+        if (l == 0) {
+            button->event_monitor = 0;
+            return FALSE;
+        }
 
-    if (ev.type == EV_SW && ev.code == SW_LID) {
-        if (ev.value > 0) {
-            button->lid_closed = true;
-        } else {
-            button->lid_closed = false;
+        const size_t count = l / sizeof(struct input_event);
+        for (size_t i = 0; i < count; i++) {
+            button_process_event(button, &events[i]);
         }
+    } while (l == sizeof(events));
 
+    if (button->lid_closed != lid_closed || button->docked != docked) {
+        recorder_record(button->frame_time, RECORDER_SWITCH, button->lid_closed, button->docked);
+        switchRegistry_update(button->manager->switches, button, lid_closed, docked);
+        latency_origin(button->frame_time, read_time);
         button->handler(button->manager);
     }
 
     return TRUE;
 }
 
-bool button_is_lid(Button* button) {
+/**
+ * Discard the queued events and take the switch state straight from the kernel, used after resume when
+ * events may have been lost or reordered.
+ *
+ * @param button
+ */
+int button_snapshot(Button* button) {
+    struct input_event events[BUTTON_EVENT_BATCH];
+    const bool lid_closed = button->lid_closed;
+    const bool docked = button->docked;
+
+    while (read(button->fd, events, sizeof(events)) > 0) {
+    }
+
+    button->dropped = false;
+    int r = button_sync(button);
+    if (r < 0) {
+        return r;
+    }
+
+    if (button->lid_closed != lid_closed || button->docked != docked) {
+        switchRegistry_update(button->manager->switches, button, lid_closed, docked);
+    }
+
+    return 0;
+}
+
+bool button_is_switch(Button* button) {
     int fd = button->fd;
 
     unsigned long types[EV_SW/ULONG_BITS+1];
@@ -51,12 +171,12 @@ bool button_is_lid(Button* button) {
         return false;
 
     if (bitset_get(types, EV_SW)) {
-        unsigned long switches[SW_LID/ULONG_BITS+1];
+        unsigned long switches[SW_MAX/ULONG_BITS+1];
 
         if (ioctl(fd, EVIOCGBIT(EV_SW, sizeof(switches)), switches) < 0)
             return false;
 
-        if (bitset_get(switches, SW_LID))
+        if (bitset_get(switches, SW_LID) || bitset_get(switches, SW_DOCK))
             return true;
     }
 
@@ -68,7 +188,7 @@ int button_set_mask(Button* button) {
 
     unsigned long
             types[EV_SW/ULONG_BITS+1] = {},
-            switches[SW_LID/ULONG_BITS+1] = {};
+            switches[SW_DOCK/ULONG_BITS+1] = {};
     struct input_mask mask;
 
     bitset_put(types, EV_KEY);
@@ -98,7 +218,7 @@ int button_set_mask(Button* button) {
     return 0;
 }
 
-Button* button_new(LidManager* manager, const char* name, lidManager_handler handler) {
+Button* button_new(const LidManager* manager, const char* name, lidManager_handler handler) {
     Button* button = malloc(sizeof(Button));
     memset(button, 0, sizeof(Button));
 
@@ -108,12 +228,17 @@ Button* button_new(LidManager* manager, const char* name, lidManager_handler han
 
     button->fd = -1;
     button->lid_closed = false;
+    button->docked = false;
+    button->frame_lid_closed = false;
+    button->frame_docked = false;
+    button->dropped = false;
+    button->frame_time = 0;
 
     return button;
 }
 
 int button_open(Button* button) {
-    const char* inputDevicePrefix = "/dev/input/";
+    const char* inputDevicePrefix = button->manager->input_dir;
     const size_t len = strlen(inputDevicePrefix) + strlen(button->name) + 1;
     _cleanup_(freep) char* deviceFile = malloc(len);
     memset(deviceFile, 0, len);
@@ -126,7 +251,7 @@ int button_open(Button* button) {
         return -1;
     }
 
-    if (button_is_lid(button) != true) {
+    if (button_is_switch(button) != true) {
         goto fail;
     }
 
@@ -136,7 +261,16 @@ int button_open(Button* button) {
     }
 
     button_set_mask(button);
-    button->event_monitor = g_unix_fd_add(button->fd, G_IO_IN, button_handler, button);
+
+    // Event timestamps are compared against CLOCK_MONOTONIC
+    int clock = CLOCK_MONOTONIC;
+    ioctl(button->fd, EVIOCSCLOCKID, &clock);
+
+    if (button_sync(button) < 0) {
+        goto fail;
+    }
+
+    button->event_monitor = eventLoop_add_fd(button->fd, button_handler, button);
 
     return 0;
 
@@ -149,16 +283,17 @@ void button_close(Button* button) {
         sd_event_source_unref(button->io_event_source);
     }*/
     if (button->event_monitor) {
-        g_source_remove(button->event_monitor);
+        eventLoop_remove(button->event_monitor);
     }
     if (button->fd) {
         close(button->fd);
     }
 
+    free(button->name);
     free(button);
 }
 
-int button_create(LidManager* lidManager, Button **pButton, const char* name, lidManager_handler handler) {
+int button_create(const LidManager* lidManager, Button **pButton, const char* name, lidManager_handler handler) {
     int r;
     Button* button = button_new(lidManager, name, handler);
     if (!button) {
@@ -6,25 +6,34 @@
 
 #include "lidManager.h"
 
+#define BUTTON_EVENT_BATCH 64
+
 struct Button;
 
 typedef struct Button {
     const struct LidManager* manager;
-    const char* name;
+    char* name;
     lidManager_handler handler;
 
     int fd;
     guint event_monitor;
 
     bool lid_closed;
+    bool docked;
+
+    bool frame_lid_closed;
+    bool frame_docked;
+    bool dropped;
+    gint64 frame_time;
 } Button;
 
-bool button_is_lid(Button* button);
+bool button_is_switch(Button* button);
 int button_set_mask(Button* button);
+int button_snapshot(Button* button);
 
-Button* button_new(LidManager* manager, const char* name, lidManager_handler handler);
+Button* button_new(const LidManager* manager, const char* name, lidManager_handler handler);
 int button_open(Button* button);
 void button_close(Button* button);
-int button_create(LidManager* lidManager, Button **pButton, const char* name, lidManager_handler handler);
+int button_create(const LidManager* lidManager, Button **pButton, const char* name, lidManager_handler handler);
 
 #endif //SYSTEMD_LID_BUTTON_H
@@ -0,0 +1,219 @@
+#include <malloc.h>
+#include <memory.h>
+
+#include "lidManager.h"
+#include "action.h"
+#include "policy.h"
+#include "capabilities.h"
+
+typedef struct CapabilityRequest {
+    Capabilities* capabilities;
+    ActionType action;
+    const char* method;
+} CapabilityRequest;
+
+/**
+ * Until logind answered every action is assumed to work, as it did before the capabilities were known.
+ */
+static void capabilities_reset(Capabilities* capabilities) {
+    for (unsigned action = 0; action < ACTION_TYPE_COUNT; action++) {
+        capabilities->viable[action] = true;
+        capabilities->unsupported[action] = false;
+    }
+}
+
+static void capabilities_set(Capabilities* capabilities, ActionType action, bool viable) {
+    if (capabilities->viable[action] != viable) {
+        capabilities->viable[action] = viable;
+        if (capabilities->manager->policy) {
+            policy_compile(capabilities->manager->policy);
+        }
+    }
+}
+
+static void capabilities_reply(GObject* source, GAsyncResult* res, gpointer user_data) {
+    CapabilityRequest* request = (CapabilityRequest*) user_data;
+    GError* error = NULL;
+
+    GVariant* result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        g_error_free(error);
+        free(request);
+        return;
+    }
+
+    Capabilities* capabilities = request->capabilities;
+    if (!result) {
+        if (g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD)) {
+            // Older logind, e.g. systemd 237 has no CanSuspendThenHibernate, nor SuspendThenHibernate
+            fprintf(stderr, "%s is not supported by logind\n", request->method);
+            capabilities->unsupported[request->action] = true;
+            capabilities_set(capabilities, request->action, false);
+        } else {
+            // Keep what was known, the action call reports its own error if it really fails
+            fprintf(stderr, "Unable to query %s: %s\n", request->method, error->message);
+        }
+        g_error_free(error);
+        free(request);
+        return;
+    }
+
+    const gchar* answer;
+    g_variant_get(result, "(&s)", &answer);
+
+    // The calls are not interactive, "challenge" fails just like "no" and "na"
+    const bool viable = strcmp(answer, "yes") == 0;
+    g_variant_unref(result);
+
+    capabilities_set(capabilities, request->action, viable);
+
+    free(request);
+}
+
+static void capabilities_query(Capabilities* capabilities, ActionType action, const char* method) {
+    if (capabilities->unsupported[action]) {
+        return;
+    }
+
+    CapabilityRequest* request = malloc(sizeof(CapabilityRequest));
+    if (!request) {
+        return;
+    }
+
+    request->capabilities = capabilities;
+    request->action = action;
+    request->method = method;
+
+    g_dbus_connection_call(
+            capabilities->connection,
+            LOGIND_BUS_NAME,
+            LOGIND_OBJECT_PATH,
+            LOGIND_MANAGER_INTERFACE,
+            method,
+            g_variant_new("()"),
+            G_VARIANT_TYPE("(s)"),
+            G_DBUS_CALL_FLAGS_NONE,
+            LOGIND_CALL_TIMEOUT,
+            capabilities->cancellable,
+            capabilities_reply,
+            request);
+}
+
+static void capabilities_refresh(Capabilities* capabilities) {
+    capabilities_query(capabilities, ACTION_SUSPEND, "CanSuspend");
+    capabilities_query(capabilities, ACTION_HIBERNATE, "CanHibernate");
+    capabilities_query(capabilities, ACTION_SHUTDOWN, "CanPowerOff");
+    capabilities_query(capabilities, ACTION_SUSPEND_THEN_HIBERNATE, "CanSuspendThenHibernate");
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+static void capabilities_properties_changed_handler(GDBusConnection *connection,
+                                                    const gchar *sender_name,
+                                                    const gchar *object_path,
+                                                    const gchar *interface_name,
+                                                    const gchar *signal_name,
+                                                    GVariant *parameters,
+                                                    gpointer user_data) {
+#pragma clang diagnostic pop
+
+    GVariant* changed;
+    const char** invalidated;
+
+    // Block inhibitors coming and going change what logind would allow. Delay inhibitors, e.g. our own being
+    // released and taken again around every sleep, do not.
+    g_variant_get(parameters, "(&s@a{sv}^a&s)", NULL, &changed, &invalidated);
+    if (g_variant_lookup(changed, "BlockInhibited", "&s", NULL) || g_strv_contains(invalidated, "BlockInhibited")) {
+        capabilities_refresh((Capabilities*) user_data);
+    }
+    g_variant_unref(changed);
+    g_free(invalidated);
+}
+
+Capabilities* capabilities_new(const struct LidManager* manager) {
+    Capabilities* capabilities = malloc(sizeof(Capabilities));
+    if (!capabilities) {
+        return NULL;
+    }
+    memset(capabilities, 0, sizeof(Capabilities));
+
+    capabilities->manager = manager;
+    capabilities->connection = NULL;
+    capabilities_reset(capabilities);
+
+    return capabilities;
+}
+
+/**
+ * Query what logind can do and follow its changes. The answers end up in the decision table, so acting on a
+ * lid close costs no extra round trip.
+ *
+ * @param capabilities
+ * @param connection
+ */
+void capabilities_attach(Capabilities* capabilities, GDBusConnection* connection) {
+    capabilities_detach(capabilities);
+
+    capabilities->connection = connection;
+    capabilities->cancellable = g_cancellable_new();
+
+    capabilities->properties_subscription = g_dbus_connection_signal_subscribe(
+            connection,
+            LOGIND_BUS_NAME,
+            "org.freedesktop.DBus.Properties",
+            "PropertiesChanged",
+            LOGIND_OBJECT_PATH,
+            LOGIND_MANAGER_INTERFACE,
+            G_DBUS_SIGNAL_FLAGS_NONE,
+            capabilities_properties_changed_handler,
+            capabilities,
+            NULL);
+
+    capabilities_refresh(capabilities);
+}
+
+void capabilities_detach(Capabilities* capabilities) {
+    if (capabilities->cancellable) {
+        g_cancellable_cancel(capabilities->cancellable);
+        g_object_unref(capabilities->cancellable);
+        capabilities->cancellable = NULL;
+    }
+    if (capabilities->properties_subscription) {
+        g_dbus_connection_signal_unsubscribe(capabilities->connection, capabilities->properties_subscription);
+        capabilities->properties_subscription = 0;
+    }
+
+    capabilities->connection = NULL;
+    capabilities_reset(capabilities);
+}
+
+/**
+ * The closest action logind can carry out: the other sleep state when one is unavailable, locking when neither
+ * sleep nor power off is.
+ *
+ * @param capabilities
+ * @param action Configured action
+ */
+ActionType capabilities_resolve(const Capabilities* capabilities, ActionType action) {
+    const bool* viable = capabilities->viable;
+
+    switch (action) {
+        case ACTION_SUSPEND:
+            return viable[ACTION_SUSPEND] ? ACTION_SUSPEND : viable[ACTION_HIBERNATE] ? ACTION_HIBERNATE : ACTION_LOCK;
+        case ACTION_HIBERNATE:
+            return viable[ACTION_HIBERNATE] ? ACTION_HIBERNATE : viable[ACTION_SUSPEND] ? ACTION_SUSPEND : ACTION_LOCK;
+        case ACTION_SUSPEND_THEN_HIBERNATE:
+            return viable[ACTION_SUSPEND_THEN_HIBERNATE] ? ACTION_SUSPEND_THEN_HIBERNATE :
+                   capabilities_resolve(capabilities, ACTION_HIBERNATE);
+        case ACTION_SHUTDOWN:
+            return viable[ACTION_SHUTDOWN] ? ACTION_SHUTDOWN : ACTION_LOCK;
+        default:
+            return action;
+    }
+}
+
+void capabilities_close(Capabilities* capabilities) {
+    capabilities_detach(capabilities);
+
+    free(capabilities);
+}
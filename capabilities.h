@@ -0,0 +1,31 @@
+#ifndef SYSTEMD_LID_CAPABILITIES_H
+#define SYSTEMD_LID_CAPABILITIES_H
+
+#include <stdbool.h>
+#include <gio/gio.h>
+
+#include "lidManager.h"
+#include "action.h"
+
+struct Capabilities;
+
+typedef struct Capabilities {
+    const struct LidManager* manager;
+    GDBusConnection* connection;
+
+    GCancellable* cancellable;
+    guint properties_subscription;
+
+    // Indexed by ActionType, whether logind would carry it out right now without asking anyone
+    bool viable[ACTION_TYPE_COUNT];
+    // Indexed by ActionType, logind does not know the method, it is not asked again on this connection
+    bool unsupported[ACTION_TYPE_COUNT];
+} Capabilities;
+
+Capabilities* capabilities_new(const struct LidManager* manager);
+void capabilities_attach(Capabilities* capabilities, GDBusConnection* connection);
+void capabilities_detach(Capabilities* capabilities);
+ActionType capabilities_resolve(const Capabilities* capabilities, ActionType action);
+void capabilities_close(Capabilities* capabilities);
+
+#endif //SYSTEMD_LID_CAPABILITIES_H
@@ -0,0 +1,180 @@
+#include <malloc.h>
+#include <memory.h>
+#include <libudev.h>
+#include <asm/errno.h>
+
+#include "basic.h"
+#include "lidManager.h"
+#include "display.h"
+#include "udevMonitor.h"
+#include "eventLoop.h"
+#include "latency.h"
+#include "recorder.h"
+
+/**
+ * Built-in panels are named card<N>-eDP-<M>, card<N>-LVDS-<M> or card<N>-DSI-<M>.
+ *
+ * @param name Connector sysname
+ */
+static bool display_connector_is_internal(const char* name) {
+    return strstr(name, "-eDP-") != NULL ||
+           strstr(name, "-LVDS-") != NULL ||
+           strstr(name, "-DSI-") != NULL;
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+static gboolean display_handler(gint fd, GIOCondition condition, void *user_data) {
+#pragma clang diagnostic pop
+
+    Display* display = (Display*) user_data;
+
+    struct udev_device* device = udev_monitor_receive_device(display->udev_monitor);
+    if (!device) {
+        return TRUE;
+    }
+    udev_device_unref(device);
+
+    // Hotplug uevents are sent for the card rather than for the connector that changed
+    const bool external_connected = display_external_connected(display);
+    if (display_scan(display) < 0) {
+        return TRUE;
+    }
+
+    if (display_external_connected(display) != external_connected) {
+        const gint64 now = latency_now();
+        recorder_record(now, RECORDER_DISPLAY, (gint32) display->external_count, 0);
+        latency_origin(now, now);
+        display->handler(display->manager);
+    }
+
+    return TRUE;
+}
+
+Display* display_new(const struct LidManager* lidManager, lidManager_handler handler) {
+    Display* display = malloc(sizeof(Display));
+    if (!display) {
+        return NULL;
+    }
+    memset(display, 0, sizeof(Display));
+
+    display->manager = lidManager;
+    display->handler = handler;
+
+    display->udev_monitor = NULL;
+    display->event_monitor = 0;
+    display->external_count = 0;
+
+    return display;
+}
+
+int display_open(Display* display) {
+    struct udev_monitor* udev_monitor = NULL;
+
+    int fd_udev = udevMonitor_open(display->manager->udev, "drm", NULL, &udev_monitor);
+    if (fd_udev < 0) {
+        return fd_udev;
+    }
+
+    display->udev_monitor = udev_monitor;
+    display->event_monitor = eventLoop_add_fd(fd_udev, display_handler, display);
+
+    return 0;
+}
+
+/**
+ * Count the connected external connectors.
+ *
+ * @param display
+ */
+int display_scan(Display* display) {
+    _cleanup_(udev_enumerate_unrefp) struct udev_enumerate *e = NULL;
+    int r;
+
+    e = udev_enumerate_new(display->manager->udev);
+    if (!e)
+        return -ENOMEM;
+
+    r = udev_enumerate_add_match_subsystem(e, "drm");
+    if (r < 0)
+        return r;
+
+    r = udev_enumerate_add_match_sysattr(e, "status", "connected");
+    if (r < 0)
+        return r;
+
+    r = udev_enumerate_scan_devices(e);
+    if (r < 0)
+        return r;
+
+    unsigned external_count = 0;
+    struct udev_list_entry *item = NULL, *first = NULL;
+    first = udev_enumerate_get_list_entry(e);
+
+    udev_list_entry_foreach(item, first) {
+        const char* syspath = udev_list_entry_get_name(item);
+        const char* name = strrchr(syspath, '/');
+        if (name && !display_connector_is_internal(name + 1)) {
+            external_count++;
+        }
+    }
+
+    display->external_count = external_count;
+
+    return 0;
+}
+
+/**
+ * Drop the queued uevents and count the connectors again, without running the handler.
+ *
+ * @param display
+ */
+int display_snapshot(Display* display) {
+    struct udev_device* device;
+
+    while ((device = udev_monitor_receive_device(display->udev_monitor))) {
+        udev_device_unref(device);
+    }
+
+    return display_scan(display);
+}
+
+void display_close(Display* display) {
+    if (display->event_monitor) {
+        eventLoop_remove(display->event_monitor);
+    }
+    if (display->udev_monitor) {
+        udev_monitor_unref(display->udev_monitor);
+    }
+
+    free(display);
+}
+
+int display_create(const struct LidManager* lidManager, Display** pDisplay, lidManager_handler handler) {
+    int r;
+    Display* display = display_new(lidManager, handler);
+    if (!display) {
+        return -ENOMEM;
+    }
+
+    // Monitor before scanning so a monitor plugged in between is not missed
+    r = display_open(display);
+    if (r < 0) {
+        goto fail;
+    }
+
+    r = display_scan(display);
+    if (r < 0) {
+        goto fail;
+    }
+
+    *pDisplay = display;
+
+    return 0;
+
+    fail:
+
+    display_close(display);
+
+    return r;
+}
@@ -0,0 +1,33 @@
+#ifndef SYSTEMD_LID_DISPLAY_H
+#define SYSTEMD_LID_DISPLAY_H
+
+#include <stdbool.h>
+#include <gio/gio.h>
+
+#include "lidManager.h"
+
+struct Display;
+
+typedef struct Display {
+    const struct LidManager* manager;
+    lidManager_handler handler;
+
+    struct udev_monitor* udev_monitor;
+    guint event_monitor;
+
+    // Connected connectors other than the built-in panel
+    unsigned external_count;
+} Display;
+
+Display* display_new(const struct LidManager* lidManager, lidManager_handler handler);
+int display_open(Display* display);
+int display_scan(Display* display);
+int display_snapshot(Display* display);
+void display_close(Display* display);
+int display_create(const struct LidManager* lidManager, Display** pDisplay, lidManager_handler handler);
+
+static inline bool display_external_connected(const Display* display) {
+    return display->external_count > 0;
+}
+
+#endif //SYSTEMD_LID_DISPLAY_H
@@ -0,0 +1,24 @@
+#ifndef SYSTEMD_LID_EVENT_LOOP_H
+#define SYSTEMD_LID_EVENT_LOOP_H
+
+#include <glib.h>
+
+/*
+ * Event loop the daemon runs on, a thin wrapper around GMainLoop.
+ *
+ * Handlers return FALSE to remove themselves, like GLib sources.
+ */
+
+typedef gboolean (*eventLoop_fd_handler)(gint fd, GIOCondition condition, void* user_data);
+typedef gboolean (*eventLoop_handler)(void* user_data);
+
+guint eventLoop_add_fd(int fd, eventLoop_fd_handler handler, void* user_data);
+guint eventLoop_add_signal(int signum, eventLoop_handler handler, void* user_data);
+// Runs every interval milliseconds until the handler returns FALSE or the source is removed
+guint eventLoop_add_timeout(guint interval, eventLoop_handler handler, void* user_data);
+void eventLoop_remove(guint id);
+
+int eventLoop_run(void);
+void eventLoop_quit(void);
+
+#endif //SYSTEMD_LID_EVENT_LOOP_H
@@ -0,0 +1,36 @@
+#include <glib-unix.h>
+
+#include "eventLoop.h"
+
+static GMainLoop* loop = NULL;
+
+guint eventLoop_add_fd(int fd, eventLoop_fd_handler handler, void* user_data) {
+    return g_unix_fd_add(fd, G_IO_IN, handler, user_data);
+}
+
+guint eventLoop_add_signal(int signum, eventLoop_handler handler, void* user_data) {
+    return g_unix_signal_add(signum, handler, user_data);
+}
+
+guint eventLoop_add_timeout(guint interval, eventLoop_handler handler, void* user_data) {
+    return g_timeout_add(interval, handler, user_data);
+}
+
+void eventLoop_remove(guint id) {
+    g_source_remove(id);
+}
+
+int eventLoop_run(void) {
+    loop = g_main_loop_new(NULL, FALSE);
+    g_main_loop_run(loop);
+    g_main_loop_unref(loop);
+    loop = NULL;
+
+    return 0;
+}
+
+void eventLoop_quit(void) {
+    if (loop) {
+        g_main_loop_quit(loop);
+    }
+}
@@ -0,0 +1,335 @@
+#include <malloc.h>
+#include <memory.h>
+#include <unistd.h>
+#include <gio/gunixfdlist.h>
+
+#include "lidManager.h"
+#include "action.h"
+#include "session.h"
+#include "inhibitor.h"
+#include "latency.h"
+#include "recorder.h"
+#include "eventLoop.h"
+
+typedef struct InhibitRequest {
+    Inhibitor* inhibitor;
+    int* fd;
+    const char* what;
+} InhibitRequest;
+
+static void inhibitor_release(int* fd) {
+    if (*fd >= 0) {
+        close(*fd);
+        *fd = -1;
+    }
+}
+
+static void inhibitor_inhibit_reply(GObject* source, GAsyncResult* res, gpointer user_data) {
+    InhibitRequest* request = (InhibitRequest*) user_data;
+    GUnixFDList* fd_list = NULL;
+    GError* error = NULL;
+
+    GVariant* result = g_dbus_connection_call_with_unix_fd_list_finish(G_DBUS_CONNECTION(source), &fd_list, res, &error);
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        g_error_free(error);
+        free(request);
+        return;
+    }
+
+    if (result) {
+        gint32 index;
+        g_variant_get(result, "(h)", &index);
+
+        inhibitor_release(request->fd);
+        *request->fd = g_unix_fd_list_get(fd_list, index, &error);
+        g_variant_unref(result);
+    }
+    if (error) {
+        fprintf(stderr, "Unable to take the %s inhibitor: %s\n", request->what, error->message);
+        g_error_free(error);
+    }
+    if (fd_list) {
+        g_object_unref(fd_list);
+    }
+
+    free(request);
+}
+
+/**
+ * Take an inhibitor lock, its fd is stored in *fd once logind replied.
+ */
+static void inhibitor_inhibit(Inhibitor* inhibitor, int* fd, const char* what, const char* why, const char* mode) {
+    InhibitRequest* request = malloc(sizeof(InhibitRequest));
+    if (!request) {
+        return;
+    }
+
+    request->inhibitor = inhibitor;
+    request->fd = fd;
+    request->what = what;
+
+    g_dbus_connection_call_with_unix_fd_list(
+            inhibitor->connection,
+            LOGIND_BUS_NAME,
+            LOGIND_OBJECT_PATH,
+            LOGIND_MANAGER_INTERFACE,
+            "Inhibit",
+            g_variant_new("(ssss)", what, INHIBITOR_WHO, why, mode),
+            G_VARIANT_TYPE("(h)"),
+            G_DBUS_CALL_FLAGS_NONE,
+            LOGIND_CALL_TIMEOUT,
+            NULL,
+            inhibitor->cancellable,
+            inhibitor_inhibit_reply,
+            request);
+}
+
+static void inhibitor_take_delay(Inhibitor* inhibitor) {
+    inhibitor_inhibit(inhibitor, &inhibitor->delay_fd, "sleep", "Lock the screen before sleeping", "delay");
+}
+
+/**
+ * Stop waiting for the session to lock and let sleep go ahead.
+ *
+ * @param inhibitor
+ */
+static void inhibitor_locked(Inhibitor* inhibitor) {
+    if (inhibitor->locked_subscription) {
+        g_dbus_connection_signal_unsubscribe(inhibitor->connection, inhibitor->locked_subscription);
+        inhibitor->locked_subscription = 0;
+    }
+    if (inhibitor->locked_timer) {
+        eventLoop_remove(inhibitor->locked_timer);
+        inhibitor->locked_timer = 0;
+    }
+
+    inhibitor_release(&inhibitor->delay_fd);
+}
+
+static gboolean inhibitor_locked_timeout(void* user_data) {
+    Inhibitor* inhibitor = (Inhibitor*) user_data;
+
+    fprintf(stderr, "The session did not report being locked, sleeping anyway\n");
+    inhibitor->locked_timer = 0;
+    inhibitor_locked(inhibitor);
+
+    return G_SOURCE_REMOVE;
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+static void inhibitor_session_changed_handler(GDBusConnection *connection,
+                                              const gchar *sender_name,
+                                              const gchar *object_path,
+                                              const gchar *interface_name,
+                                              const gchar *signal_name,
+                                              GVariant *parameters,
+                                              gpointer user_data) {
+#pragma clang diagnostic pop
+
+    Inhibitor* inhibitor = (Inhibitor*) user_data;
+    GVariant* changed;
+    gboolean locked;
+
+    g_variant_get(parameters, "(&s@a{sv}@as)", NULL, &changed, NULL);
+    if (g_variant_lookup(changed, "LockedHint", "b", &locked) && locked) {
+        inhibitor_locked(inhibitor);
+    }
+    g_variant_unref(changed);
+}
+
+static void inhibitor_locked_hint_reply(GObject* source, GAsyncResult* res, gpointer user_data) {
+    GError* error = NULL;
+
+    GVariant* result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        g_error_free(error);
+        return;
+    }
+    g_clear_error(&error);
+
+    // Already locked before Lock was sent, no change will be reported. Errors are left to the timer.
+    Inhibitor* inhibitor = (Inhibitor*) user_data;
+    if (result) {
+        GVariant* value;
+        g_variant_get(result, "(v)", &value);
+        if (g_variant_is_of_type(value, G_VARIANT_TYPE_BOOLEAN) && g_variant_get_boolean(value)) {
+            inhibitor_locked(inhibitor);
+        }
+        g_variant_unref(value);
+        g_variant_unref(result);
+    }
+}
+
+static void inhibitor_lock_reply(GObject* source, GAsyncResult* res, gpointer user_data) {
+    GError* error = NULL;
+
+    GVariant* result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        g_error_free(error);
+        return;
+    }
+
+    Inhibitor* inhibitor = (Inhibitor*) user_data;
+    if (!result) {
+        // Sleep goes ahead either way
+        fprintf(stderr, "Unable to lock the session before sleeping: %s\n", error->message);
+        g_error_free(error);
+        inhibitor_locked(inhibitor);
+        return;
+    }
+    g_variant_unref(result);
+
+    // The reply only means the Lock signal went out, the screen is locked once the shell sets LockedHint
+    const char* session_path = inhibitor->manager->session->path;
+    if (!session_path) {
+        inhibitor_locked(inhibitor);
+        return;
+    }
+
+    g_dbus_connection_call(
+            inhibitor->connection,
+            LOGIND_BUS_NAME,
+            session_path,
+            "org.freedesktop.DBus.Properties",
+            "Get",
+            g_variant_new("(ss)", LOGIND_SESSION_INTERFACE, "LockedHint"),
+            G_VARIANT_TYPE("(v)"),
+            G_DBUS_CALL_FLAGS_NONE,
+            LOGIND_CALL_TIMEOUT,
+            inhibitor->cancellable,
+            inhibitor_locked_hint_reply,
+            inhibitor);
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+static void inhibitor_prepare_for_sleep_handler(GDBusConnection *connection,
+                                                const gchar *sender_name,
+                                                const gchar *object_path,
+                                                const gchar *interface_name,
+                                                const gchar *signal_name,
+                                                GVariant *parameters,
+                                                gpointer user_data) {
+#pragma clang diagnostic pop
+
+    Inhibitor* inhibitor = (Inhibitor*) user_data;
+    gboolean start;
+
+    g_variant_get(parameters, "(b)", &start);
+    recorder_record(latency_now(), RECORDER_SLEEP, start, 0);
+
+    if (!start) {
+        // Resumed, hold the next sleep back again and catch up with what changed while asleep
+        inhibitor_locked(inhibitor);
+        if (inhibitor->delay_fd < 0) {
+            inhibitor_take_delay(inhibitor);
+        }
+        lidManager_snapshot(inhibitor->manager);
+        return;
+    }
+
+    if (inhibitor->delay_fd < 0 || inhibitor->locked_subscription) {
+        return;
+    }
+
+    const char* session_path = inhibitor->manager->session->path;
+    if (!session_path) {
+        inhibitor_release(&inhibitor->delay_fd);
+        return;
+    }
+
+    inhibitor->locked_subscription = g_dbus_connection_signal_subscribe(
+            connection,
+            LOGIND_BUS_NAME,
+            "org.freedesktop.DBus.Properties",
+            "PropertiesChanged",
+            session_path,
+            LOGIND_SESSION_INTERFACE,
+            G_DBUS_SIGNAL_FLAGS_NONE,
+            inhibitor_session_changed_handler,
+            inhibitor,
+            NULL);
+    inhibitor->locked_timer = eventLoop_add_timeout(INHIBITOR_LOCK_TIMEOUT, inhibitor_locked_timeout, inhibitor);
+
+    g_dbus_connection_call(
+            connection,
+            LOGIND_BUS_NAME,
+            session_path,
+            LOGIND_SESSION_INTERFACE,
+            "Lock",
+            g_variant_new("()"),
+            NULL,
+            G_DBUS_CALL_FLAGS_NONE,
+            LOGIND_CALL_TIMEOUT,
+            inhibitor->cancellable,
+            inhibitor_lock_reply,
+            inhibitor);
+}
+
+Inhibitor* inhibitor_new(const struct LidManager* manager) {
+    Inhibitor* inhibitor = malloc(sizeof(Inhibitor));
+    if (!inhibitor) {
+        return NULL;
+    }
+    memset(inhibitor, 0, sizeof(Inhibitor));
+
+    inhibitor->manager = manager;
+    inhibitor->connection = NULL;
+    inhibitor->block_fd = -1;
+    inhibitor->delay_fd = -1;
+
+    return inhibitor;
+}
+
+/**
+ * Take the lid switch block and sleep delay inhibitors on a logind connection. Called again whenever logind
+ * (re)appears, inhibitors of the previous instance are dropped.
+ *
+ * @param inhibitor
+ * @param connection
+ */
+void inhibitor_attach(Inhibitor* inhibitor, GDBusConnection* connection) {
+    inhibitor_detach(inhibitor);
+
+    inhibitor->connection = connection;
+    inhibitor->cancellable = g_cancellable_new();
+
+    inhibitor->prepare_for_sleep_subscription = g_dbus_connection_signal_subscribe(
+            connection,
+            LOGIND_BUS_NAME,
+            LOGIND_MANAGER_INTERFACE,
+            "PrepareForSleep",
+            LOGIND_OBJECT_PATH,
+            NULL,
+            G_DBUS_SIGNAL_FLAGS_NONE,
+            inhibitor_prepare_for_sleep_handler,
+            inhibitor,
+            NULL);
+
+    inhibitor_inhibit(inhibitor, &inhibitor->block_fd, "handle-lid-switch", "user preference", "block");
+    inhibitor_take_delay(inhibitor);
+}
+
+void inhibitor_detach(Inhibitor* inhibitor) {
+    if (inhibitor->cancellable) {
+        g_cancellable_cancel(inhibitor->cancellable);
+        g_object_unref(inhibitor->cancellable);
+        inhibitor->cancellable = NULL;
+    }
+    if (inhibitor->prepare_for_sleep_subscription) {
+        g_dbus_connection_signal_unsubscribe(inhibitor->connection, inhibitor->prepare_for_sleep_subscription);
+        inhibitor->prepare_for_sleep_subscription = 0;
+    }
+
+    inhibitor_locked(inhibitor);
+    inhibitor_release(&inhibitor->block_fd);
+
+    inhibitor->connection = NULL;
+}
+
+void inhibitor_close(Inhibitor* inhibitor) {
+    inhibitor_detach(inhibitor);
+
+    free(inhibitor);
+}
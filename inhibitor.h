@@ -0,0 +1,45 @@
+#ifndef SYSTEMD_LID_INHIBITOR_H
+#define SYSTEMD_LID_INHIBITOR_H
+
+#include <stdbool.h>
+#include <gio/gio.h>
+
+#include "lidManager.h"
+
+#define INHIBITOR_WHO "ubuntu-lid-fixer"
+// How long sleep is held back waiting for the session's LockedHint, below logind's 5 s InhibitDelayMaxSec
+#define INHIBITOR_LOCK_TIMEOUT 3000
+
+struct Inhibitor;
+
+typedef struct Inhibitor {
+    const struct LidManager* manager;
+    GDBusConnection* connection;
+
+    // Keeps logind from handling the lid itself
+    int block_fd;
+    // Holds sleep back until the session is locked
+    int delay_fd;
+
+    GCancellable* cancellable;
+    guint prepare_for_sleep_subscription;
+    // Waiting for the session to report LockedHint before releasing delay_fd
+    guint locked_subscription;
+    guint locked_timer;
+} Inhibitor;
+
+Inhibitor* inhibitor_new(const struct LidManager* manager);
+void inhibitor_attach(Inhibitor* inhibitor, GDBusConnection* connection);
+void inhibitor_detach(Inhibitor* inhibitor);
+void inhibitor_close(Inhibitor* inhibitor);
+
+/**
+ * Whether the session is locked on PrepareForSleep, so sleep actions need not lock first.
+ *
+ * @param inhibitor
+ */
+static inline bool inhibitor_locks_on_sleep(const Inhibitor* inhibitor) {
+    return inhibitor->delay_fd >= 0;
+}
+
+#endif //SYSTEMD_LID_INHIBITOR_H
@@ -0,0 +1,119 @@
+#include <time.h>
+
+#include "action.h"
+#include "latency.h"
+
+static Histogram histograms[ACTION_TYPE_COUNT][LATENCY_STAGE_COUNT];
+static LatencyTrace origin;
+
+static const char* latency_stage_name(LatencyStage stage) {
+    switch (stage) {
+        case LATENCY_READ:
+            return "read";
+        case LATENCY_DECISION:
+            return "decision";
+        case LATENCY_HOLDOFF:
+            return "holdoff";
+        case LATENCY_LOOKUP:
+            return "lookup";
+        case LATENCY_CALL:
+            return "call";
+        case LATENCY_REPLY:
+            return "reply";
+        case LATENCY_TOTAL:
+            return "total";
+        default:
+            return "unknown";
+    }
+}
+
+gint64 latency_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (gint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+gint64 latency_timeval(long sec, long usec) {
+    return (gint64) sec * 1000000000 + (gint64) usec * 1000;
+}
+
+/**
+ * Remember when the event being handled happened and when it was read. Events without a kernel timestamp pass
+ * the read time for both.
+ *
+ * @param event
+ * @param read
+ */
+void latency_origin(gint64 event, gint64 read) {
+    origin.event = event;
+    origin.read = read;
+}
+
+LatencyTrace latency_decide(void) {
+    LatencyTrace trace = origin;
+    trace.decision = latency_now();
+
+    return trace;
+}
+
+void latency_record(unsigned action, LatencyStage stage, gint64 ns) {
+    if (action >= ACTION_TYPE_COUNT || ns < 0) {
+        return;
+    }
+
+    Histogram* histogram = &histograms[action][stage];
+    unsigned bucket = (ns > 0)? 63 - __builtin_clzll((unsigned long long) ns) : 0;
+    if (bucket >= LATENCY_BUCKETS) {
+        bucket = LATENCY_BUCKETS - 1;
+    }
+
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    if (ns > histogram->max) {
+        histogram->max = ns;
+    }
+}
+
+/**
+ * Upper bound in microseconds of the bucket holding the given percentile.
+ */
+static double latency_percentile(const Histogram* histogram, unsigned percent) {
+    const guint64 rank = (histogram->count * percent + 99) / 100;
+    guint64 seen = 0;
+
+    for (unsigned i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            const gint64 bound = (gint64) (1ULL << (i + 1));
+            return ((bound < histogram->max)? bound : histogram->max) / 1000.0;
+        }
+    }
+
+    return histogram->max / 1000.0;
+}
+
+void latency_dump(FILE* file) {
+    fprintf(file, "%-10s %-9s %8s %10s %10s %10s %10s\n", "action", "stage", "count", "p50 us", "p90 us", "p99 us",
+            "max us");
+
+    for (unsigned action = 0; action < ACTION_TYPE_COUNT; action++) {
+        for (unsigned stage = 0; stage < LATENCY_STAGE_COUNT; stage++) {
+            const Histogram* histogram = &histograms[action][stage];
+            if (!histogram->count) {
+                continue;
+            }
+
+            fprintf(file, "%-10s %-9s %8llu %10.1f %10.1f %10.1f %10.1f\n",
+                    action_type_name(action),
+                    latency_stage_name(stage),
+                    (unsigned long long) histogram->count,
+                    latency_percentile(histogram, 50),
+                    latency_percentile(histogram, 90),
+                    latency_percentile(histogram, 99),
+                    histogram->max / 1000.0);
+        }
+    }
+
+    fflush(file);
+}
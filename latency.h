@@ -0,0 +1,50 @@
+#ifndef SYSTEMD_LID_LATENCY_H
+#define SYSTEMD_LID_LATENCY_H
+
+#include <stdio.h>
+#include <glib.h>
+
+// Log2 buckets of nanoseconds, the last one collects everything above
+#define LATENCY_BUCKETS 40
+
+typedef enum LatencyStage {
+    // Kernel event time to the event being read
+    LATENCY_READ = 0,
+    // Kernel event time to the policy decision
+    LATENCY_DECISION,
+    // Decision to the lid close hold-off expiring, the later stages leave it out
+    LATENCY_HOLDOFF,
+    // Looking up the configured action
+    LATENCY_LOOKUP,
+    // Kernel event time to a logind call, or the lid open wake-up, being sent
+    LATENCY_CALL,
+    // A logind call being sent to its reply
+    LATENCY_REPLY,
+    // Kernel event time to the last reply of the action
+    LATENCY_TOTAL,
+    LATENCY_STAGE_COUNT,
+} LatencyStage;
+
+// Timestamps (CLOCK_MONOTONIC, ns) of the event a decision was taken for
+typedef struct LatencyTrace {
+    gint64 event;
+    gint64 read;
+    gint64 decision;
+} LatencyTrace;
+
+typedef struct Histogram {
+    guint64 count;
+    gint64 max;
+    guint64 buckets[LATENCY_BUCKETS];
+} Histogram;
+
+gint64 latency_now(void);
+gint64 latency_timeval(long sec, long usec);
+
+void latency_origin(gint64 event, gint64 read);
+LatencyTrace latency_decide(void);
+
+void latency_record(unsigned action, LatencyStage stage, gint64 ns);
+void latency_dump(FILE* file);
+
+#endif //SYSTEMD_LID_LATENCY_H
@@ -1,11 +1,30 @@
 #include <memory.h>
+#include <stdlib.h>
 #include <libudev.h>
 #include <asm/errno.h>
 
 #include "lidManager.h"
+#include "switchRegistry.h"
+#include "power.h"
+#include "display.h"
+#include "action.h"
+#include "logind.h"
+#include "session.h"
+#include "inhibitor.h"
+#include "capabilities.h"
+#include "settings.h"
+#include "service.h"
+#include "wake.h"
+#include "policy.h"
 #include "button.h"
+#include "latency.h"
 
-int lidManager_new(LidManager** pLidManager) {
+/**
+ * @param pLidManager
+ * @param handler
+ * @param seat Seat to serve system-wide, NULL to serve the session we run in
+ */
+int lidManager_new(LidManager** pLidManager, lidManager_handler handler, const char* seat) {
     LidManager* lidManager = malloc(sizeof(LidManager));
     memset(lidManager, 0, sizeof(LidManager));
 
@@ -13,24 +32,168 @@ int lidManager_new(LidManager** pLidManager) {
         return -ENOMEM;
     }
 
+    lidManager->handler = handler;
+    lidManager->seat = (seat)? strdup(seat) : NULL;
+
+    const char* sysfs_root = getenv("GNOME3_LID_SYSFS_ROOT");
+    const char* dev_root = getenv("GNOME3_LID_DEV_ROOT");
+    lidManager->power_supply_dir = g_strdup_printf("%s/class/power_supply", (sysfs_root)? sysfs_root : "/sys");
+    lidManager->input_dir = g_strdup_printf("%s/input/", (dev_root)? dev_root : "/dev");
+
     lidManager->udev = udev_new();
     if (!lidManager->udev) {
         return -ENOMEM;
     }
 
+    lidManager->switches = switchRegistry_new(lidManager);
+    if (!lidManager->switches) {
+        return -ENOMEM;
+    }
+
+    lidManager->logind = logind_new();
+    if (!lidManager->logind) {
+        return -ENOMEM;
+    }
+
+    lidManager->actions = actionQueue_new(lidManager);
+    if (!lidManager->actions) {
+        return -ENOMEM;
+    }
+
+    lidManager->session = session_new(lidManager);
+    if (!lidManager->session) {
+        return -ENOMEM;
+    }
+
+    lidManager->inhibitor = inhibitor_new(lidManager);
+    if (!lidManager->inhibitor) {
+        return -ENOMEM;
+    }
+
+    lidManager->capabilities = capabilities_new(lidManager);
+    if (!lidManager->capabilities) {
+        return -ENOMEM;
+    }
+
+    lidManager->settings = settings_new(lidManager);
+    if (!lidManager->settings) {
+        return -ENOMEM;
+    }
+
+    lidManager->policy = policy_new(lidManager);
+    if (!lidManager->policy) {
+        return -ENOMEM;
+    }
+
     *pLidManager = lidManager;
 
     return 0;
 }
 
+/**
+ * Whether a device belongs to the seat we serve. Devices without ID_SEAT are on seat0, inside a session every
+ * device is ours.
+ *
+ * @param lidManager
+ * @param device
+ */
+bool lidManager_on_seat(const LidManager* lidManager, struct udev_device* device) {
+    if (!lidManager->seat) {
+        return true;
+    }
+
+    const char* seat = udev_device_get_property_value(device, "ID_SEAT");
+
+    return strcmp((seat)? seat : "seat0", lidManager->seat) == 0;
+}
+
+/**
+ * Take the switch, supply and display state from the kernel in one go and evaluate the policy once, used after
+ * resume. Events queued while asleep are dropped rather than replayed.
+ *
+ * @param lidManager
+ */
+void lidManager_snapshot(const LidManager* lidManager) {
+    const unsigned switches = switchRegistry_state(lidManager->switches);
+
+    switchRegistry_snapshot(lidManager->switches);
+
+    // Opening the lid woke us up and its event was dropped with the rest
+    const gint64 now = latency_now();
+    if ((switches & SWITCH_LID_CLOSED) && !(switchRegistry_state(lidManager->switches) & SWITCH_LID_CLOSED) &&
+        lidManager->wake) {
+        wake_lid_opened(lidManager->wake, now);
+    }
+
+    if (lidManager->power) {
+        power_snapshot(lidManager->power);
+    }
+    if (lidManager->display) {
+        display_snapshot(lidManager->display);
+    }
+
+    policy_reset(lidManager->policy);
+
+    latency_origin(now, now);
+    lidManager->handler(lidManager);
+}
+
 void lidManager_close(LidManager* lidManager) {
-    if (lidManager->button) {
-        button_close(lidManager->button);
+    if (lidManager->service) {
+        service_close(lidManager->service);
+    }
+
+    if (lidManager->wake) {
+        wake_close(lidManager->wake);
+    }
+
+    if (lidManager->switches) {
+        switchRegistry_close(lidManager->switches);
+    }
+
+    if (lidManager->policy) {
+        policy_close(lidManager->policy);
+    }
+
+    if (lidManager->power) {
+        power_close(lidManager->power);
+    }
+
+    if (lidManager->display) {
+        display_close(lidManager->display);
+    }
+
+    if (lidManager->actions) {
+        actionQueue_close(lidManager->actions);
+    }
+
+    if (lidManager->logind) {
+        logind_close(lidManager->logind);
+    }
+
+    if (lidManager->session) {
+        session_close(lidManager->session);
+    }
+
+    if (lidManager->inhibitor) {
+        inhibitor_close(lidManager->inhibitor);
+    }
+
+    if (lidManager->capabilities) {
+        capabilities_close(lidManager->capabilities);
+    }
+
+    if (lidManager->settings) {
+        settings_close(lidManager->settings);
     }
 
     if (lidManager->udev) {
         udev_unref(lidManager->udev);
     }
 
+    free(lidManager->seat);
+    g_free(lidManager->power_supply_dir);
+    g_free(lidManager->input_dir);
+
     free(lidManager);
 }
\ No newline at end of file
@@ -5,26 +5,58 @@
 #ifndef SYSTEMD_LID_LID_H
 #define SYSTEMD_LID_LID_H
 
+#include <stdbool.h>
 #include <libudev.h>
 #include <gio/gio.h>
 
 struct LidManager;
-struct Button;
+struct SwitchRegistry;
 struct Power;
+struct Display;
+struct ActionQueue;
+struct Session;
+struct Settings;
+struct Policy;
+struct Inhibitor;
+struct Logind;
+struct Service;
+struct Capabilities;
+struct Wake;
+
+typedef void (*lidManager_handler)(const struct LidManager* lidManager);
 
 typedef struct LidManager {
     struct udev* udev;
+    lidManager_handler handler;
+
+    // Seat served by the system-wide instance, NULL when running inside a session
+    char* seat;
+
+    // Overridable through $GNOME3_LID_SYSFS_ROOT and $GNOME3_LID_DEV_ROOT
+    char* power_supply_dir;
+    char* input_dir;
 
-    GMainLoop *loop;
     GDBusConnection *connection;
 
-    struct Button* button;
+    struct SwitchRegistry* switches;
     struct Power* power;
+    struct Display* display;
+
+    struct Logind* logind;
+    struct ActionQueue* actions;
+    struct Session* session;
+    struct Inhibitor* inhibitor;
+    struct Capabilities* capabilities;
+    struct Settings* settings;
+    struct Policy* policy;
+    // Exported state, not created by every user of the manager
+    struct Service* service;
+    struct Wake* wake;
 } LidManager;
 
-typedef void (*lidManager_handler)(const LidManager* lidManager);
-
-int lidManager_new(LidManager** pLidManager);
+int lidManager_new(LidManager** pLidManager, lidManager_handler handler, const char* seat);
+bool lidManager_on_seat(const LidManager* lidManager, struct udev_device* device);
+void lidManager_snapshot(const LidManager* lidManager);
 void lidManager_close(LidManager* lidManager);
 
 #endif //SYSTEMD_LID_LID_H
@@ -0,0 +1,41 @@
+#ifndef SYSTEMD_LID_LOGIND_H
+#define SYSTEMD_LID_LOGIND_H
+
+#include <gio/gio.h>
+
+/*
+ * Backend issuing the logind calls actions are made of. The GDBus implementation shares the connection the
+ * daemon watches logind on, the sd-bus implementation (GNOME3_LID_SDBUS) opens a connection of its own to the
+ * same bus.
+ *
+ * The reply handler runs exactly once per call, with 0, -ECANCELED once the cancellable was triggered, or
+ * another negative error.
+ */
+
+typedef enum LogindMethod {
+    // Session.Lock on the session object
+    LOGIND_LOCK_SESSION = 0,
+    LOGIND_SUSPEND,
+    LOGIND_HIBERNATE,
+    LOGIND_POWER_OFF,
+    LOGIND_SUSPEND_THEN_HIBERNATE,
+    LOGIND_METHOD_COUNT,
+} LogindMethod;
+
+typedef void (*logind_reply)(int error, void* user_data);
+
+struct Logind;
+typedef struct Logind Logind;
+
+Logind* logind_new(void);
+int logind_attach(Logind* logind, GDBusConnection* connection);
+void logind_detach(Logind* logind);
+void logind_close(Logind* logind);
+
+/**
+ * @param session_path Object path of the session for LOGIND_LOCK_SESSION, ignored otherwise
+ */
+void logind_call(Logind* logind, LogindMethod method, const char* session_path, GCancellable* cancellable,
+                 logind_reply reply, void* user_data);
+
+#endif //SYSTEMD_LID_LOGIND_H
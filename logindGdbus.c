@@ -0,0 +1,107 @@
+#include <errno.h>
+#include <malloc.h>
+#include <memory.h>
+
+#include "action.h"
+#include "session.h"
+#include "logind.h"
+
+struct Logind {
+    GDBusConnection* connection;
+};
+
+typedef struct LogindCall {
+    logind_reply reply;
+    void* user_data;
+} LogindCall;
+
+static const char* logind_method_names[LOGIND_METHOD_COUNT] = {
+        [LOGIND_LOCK_SESSION] = "Lock",
+        [LOGIND_SUSPEND] = "Suspend",
+        [LOGIND_HIBERNATE] = "Hibernate",
+        [LOGIND_POWER_OFF] = "PowerOff",
+        [LOGIND_SUSPEND_THEN_HIBERNATE] = "SuspendThenHibernate",
+};
+
+static int logind_error(const GError* error) {
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        return -ECANCELED;
+    } else if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT)) {
+        return -ETIMEDOUT;
+    }
+
+    return -EIO;
+}
+
+static void logind_call_reply(GObject* source, GAsyncResult* res, gpointer user_data) {
+    LogindCall* call = (LogindCall*) user_data;
+    GError* error = NULL;
+    int r = 0;
+
+    GVariant* result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (result) {
+        g_variant_unref(result);
+    } else {
+        r = logind_error(error);
+        g_error_free(error);
+    }
+
+    call->reply(r, call->user_data);
+    free(call);
+}
+
+Logind* logind_new(void) {
+    Logind* logind = malloc(sizeof(Logind));
+    if (!logind) {
+        return NULL;
+    }
+    memset(logind, 0, sizeof(Logind));
+
+    return logind;
+}
+
+int logind_attach(Logind* logind, GDBusConnection* connection) {
+    logind->connection = connection;
+
+    return 0;
+}
+
+void logind_detach(Logind* logind) {
+    logind->connection = NULL;
+}
+
+void logind_close(Logind* logind) {
+    free(logind);
+}
+
+void logind_call(Logind* logind, LogindMethod method, const char* session_path, GCancellable* cancellable,
+                 logind_reply reply, void* user_data) {
+    if (!logind->connection) {
+        reply(-ENOTCONN, user_data);
+        return;
+    }
+
+    LogindCall* call = malloc(sizeof(LogindCall));
+    if (!call) {
+        reply(-ENOMEM, user_data);
+        return;
+    }
+    call->reply = reply;
+    call->user_data = user_data;
+
+    const bool session = (method == LOGIND_LOCK_SESSION);
+
+    g_dbus_connection_call(
+            logind->connection,
+            LOGIND_BUS_NAME,
+            session? session_path : LOGIND_OBJECT_PATH,
+            session? LOGIND_SESSION_INTERFACE : LOGIND_MANAGER_INTERFACE,
+            logind_method_names[method],
+            session? g_variant_new("()") : g_variant_new("(b)", FALSE),
+            NULL,
+            G_DBUS_CALL_FLAGS_NONE,
+            LOGIND_CALL_TIMEOUT,
+            cancellable,
+            logind_call_reply,
+            call);
+}
@@ -0,0 +1,328 @@
+#include <errno.h>
+#include <malloc.h>
+#include <memory.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <time.h>
+#include <systemd/sd-bus.h>
+
+#include "action.h"
+#include "session.h"
+#include "eventLoop.h"
+#include "logind.h"
+
+// Retry delay in ms while the socket cannot take the queued messages, the fd is only watched for input
+#define LOGIND_WRITE_RETRY 1
+
+struct Logind {
+    sd_bus* bus;
+    guint event_monitor;
+    guint timeout_monitor;
+
+    // Calls waiting for a reply
+    GQueue pending;
+};
+
+typedef struct LogindCall {
+    Logind* logind;
+    sd_bus_slot* slot;
+
+    GCancellable* cancellable;
+    gulong cancelled_handler;
+    guint cancelled_source;
+
+    logind_reply reply;
+    void* user_data;
+} LogindCall;
+
+static const struct {
+    const char* interface;
+    const char* method;
+} logind_methods[LOGIND_METHOD_COUNT] = {
+        [LOGIND_LOCK_SESSION] = { LOGIND_SESSION_INTERFACE, "Lock" },
+        [LOGIND_SUSPEND] = { LOGIND_MANAGER_INTERFACE, "Suspend" },
+        [LOGIND_HIBERNATE] = { LOGIND_MANAGER_INTERFACE, "Hibernate" },
+        [LOGIND_POWER_OFF] = { LOGIND_MANAGER_INTERFACE, "PowerOff" },
+        [LOGIND_SUSPEND_THEN_HIBERNATE] = { LOGIND_MANAGER_INTERFACE, "SuspendThenHibernate" },
+};
+
+static void logind_process(Logind* logind) {
+    while (sd_bus_process(logind->bus, NULL) > 0) {
+    }
+}
+
+static void logind_rearm(Logind* logind);
+
+static gboolean logind_timeout_handler(void* user_data) {
+    Logind* logind = (Logind*) user_data;
+
+    logind->timeout_monitor = 0;
+    logind_process(logind);
+    logind_rearm(logind);
+
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Wake up when sd-bus next needs to run without input arriving: to write what is still queued, without blocking,
+ * or to expire the earliest call timeout.
+ *
+ * @param logind
+ */
+static void logind_rearm(Logind* logind) {
+    if (logind->timeout_monitor) {
+        eventLoop_remove(logind->timeout_monitor);
+        logind->timeout_monitor = 0;
+    }
+    if (!logind->bus) {
+        return;
+    }
+
+    guint delay;
+    uint64_t deadline;
+
+    if (sd_bus_get_events(logind->bus) & POLLOUT) {
+        delay = LOGIND_WRITE_RETRY;
+    } else if (sd_bus_get_timeout(logind->bus, &deadline) > 0 && deadline != UINT64_MAX) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        const uint64_t now = (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+        delay = (deadline > now)? (guint) ((deadline - now + 999) / 1000) : 0;
+    } else {
+        return;
+    }
+
+    logind->timeout_monitor = eventLoop_add_timeout(delay, logind_timeout_handler, logind);
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+static gboolean logind_bus_handler(gint fd, GIOCondition condition, void *user_data) {
+#pragma clang diagnostic pop
+
+    Logind* logind = (Logind*) user_data;
+
+    logind_process(logind);
+    logind_rearm(logind);
+
+    return TRUE;
+}
+
+/**
+ * Hand the result to the caller and release the call.
+ */
+static void logind_call_finish(LogindCall* call, int error) {
+    Logind* logind = call->logind;
+
+    g_queue_remove(&logind->pending, call);
+    if (call->slot) {
+        sd_bus_slot_unref(call->slot);
+    }
+    if (call->cancelled_handler) {
+        g_cancellable_disconnect(call->cancellable, call->cancelled_handler);
+    }
+    if (call->cancelled_source) {
+        eventLoop_remove(call->cancelled_source);
+    }
+    if (call->cancellable) {
+        g_object_unref(call->cancellable);
+    }
+
+    call->reply(error, call->user_data);
+    free(call);
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+static int logind_call_reply(sd_bus_message* message, void* user_data, sd_bus_error* ret_error) {
+#pragma clang diagnostic pop
+
+    LogindCall* call = (LogindCall*) user_data;
+    int r = 0;
+
+    if (sd_bus_message_is_method_error(message, NULL)) {
+        r = -sd_bus_message_get_errno(message);
+        if (r == 0) {
+            r = -EIO;
+        }
+    }
+
+    logind_call_finish(call, r);
+
+    return 0;
+}
+
+static gboolean logind_call_cancelled_idle(void* user_data) {
+    LogindCall* call = (LogindCall*) user_data;
+
+    call->cancelled_source = 0;
+    logind_call_finish(call, -ECANCELED);
+
+    return G_SOURCE_REMOVE;
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+static void logind_call_cancelled(GCancellable* cancellable, gpointer user_data) {
+#pragma clang diagnostic pop
+
+    LogindCall* call = (LogindCall*) user_data;
+
+    // Drop the reply now, report the cancellation from the loop like GDBus does
+    if (call->slot) {
+        call->slot = sd_bus_slot_unref(call->slot);
+    }
+    if (!call->cancelled_source) {
+        call->cancelled_source = eventLoop_add_timeout(0, logind_call_cancelled_idle, call);
+    }
+}
+
+Logind* logind_new(void) {
+    Logind* logind = malloc(sizeof(Logind));
+    if (!logind) {
+        return NULL;
+    }
+    memset(logind, 0, sizeof(Logind));
+
+    g_queue_init(&logind->pending);
+
+    return logind;
+}
+
+/**
+ * Open our own connection to the bus logind was found on. The GDBus connection is only used to tell which bus.
+ *
+ * @param logind
+ * @param connection
+ */
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+int logind_attach(Logind* logind, GDBusConnection* connection) {
+#pragma clang diagnostic pop
+
+    const char* address = getenv("GNOME3_LID_BUS_ADDRESS");
+    sd_bus* bus = NULL;
+    int r;
+
+    logind_detach(logind);
+
+    if (address) {
+        r = sd_bus_new(&bus);
+        if (r < 0) {
+            return r;
+        }
+
+        r = sd_bus_set_address(bus, address);
+        if (r >= 0) {
+            r = sd_bus_set_bus_client(bus, 1);
+        }
+        if (r >= 0) {
+            r = sd_bus_start(bus);
+        }
+    } else {
+        r = sd_bus_open_system(&bus);
+    }
+    if (r < 0) {
+        goto fail;
+    }
+
+    r = sd_bus_get_fd(bus);
+    if (r < 0) {
+        goto fail;
+    }
+
+    logind->bus = bus;
+    logind->event_monitor = eventLoop_add_fd(r, logind_bus_handler, logind);
+
+    return 0;
+
+    fail:
+
+    fprintf(stderr, "Unable to connect sd-bus: %s\n", strerror(-r));
+    sd_bus_unref(bus);
+
+    return r;
+}
+
+void logind_detach(Logind* logind) {
+    if (logind->timeout_monitor) {
+        eventLoop_remove(logind->timeout_monitor);
+        logind->timeout_monitor = 0;
+    }
+    if (logind->event_monitor) {
+        eventLoop_remove(logind->event_monitor);
+        logind->event_monitor = 0;
+    }
+
+    // Reply handlers may issue new calls, which now fail right away
+    sd_bus* bus = logind->bus;
+    logind->bus = NULL;
+
+    LogindCall* call;
+    while ((call = g_queue_peek_head(&logind->pending))) {
+        logind_call_finish(call, -ENOTCONN);
+    }
+
+    // Without flushing, which would block the loop. Same as sd_bus_close_unref(), which needs systemd 241.
+    if (bus) {
+        sd_bus_close(bus);
+        sd_bus_unref(bus);
+    }
+}
+
+void logind_close(Logind* logind) {
+    logind_detach(logind);
+
+    free(logind);
+}
+
+void logind_call(Logind* logind, LogindMethod method, const char* session_path, GCancellable* cancellable,
+                 logind_reply reply, void* user_data) {
+    if (!logind->bus) {
+        reply(-ENOTCONN, user_data);
+        return;
+    }
+
+    LogindCall* call = malloc(sizeof(LogindCall));
+    if (!call) {
+        reply(-ENOMEM, user_data);
+        return;
+    }
+    memset(call, 0, sizeof(LogindCall));
+
+    call->logind = logind;
+    call->reply = reply;
+    call->user_data = user_data;
+
+    const bool session = (method == LOGIND_LOCK_SESSION);
+    sd_bus_message* message = NULL;
+
+    int r = sd_bus_message_new_method_call(logind->bus, &message, LOGIND_BUS_NAME,
+                                           session? session_path : LOGIND_OBJECT_PATH,
+                                           logind_methods[method].interface, logind_methods[method].method);
+    if (r >= 0 && !session) {
+        // Not interactive
+        r = sd_bus_message_append(message, "b", 0);
+    }
+    if (r >= 0) {
+        // Same timeout as the GDBus backend rather than sd-bus's default of 25 s
+        r = sd_bus_call_async(logind->bus, &call->slot, message, logind_call_reply, call,
+                              (uint64_t) LOGIND_CALL_TIMEOUT * 1000);
+    }
+    sd_bus_message_unref(message);
+    if (r < 0) {
+        free(call);
+        reply(r, user_data);
+        return;
+    }
+
+    g_queue_push_tail(&logind->pending, call);
+
+    if (cancellable) {
+        call->cancellable = g_object_ref(cancellable);
+        call->cancelled_handler = g_cancellable_connect(cancellable, G_CALLBACK(logind_call_cancelled), call, NULL);
+    }
+
+    logind_rearm(logind);
+}
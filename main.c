@@ -1,242 +1,98 @@
 #include <fcntl.h>
 #include <malloc.h>
 #include <memory.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <libudev.h>
 #include <asm/errno.h>
-#include <dconf/dconf.h>
 #include <linux/input.h>
 #include <sys/ioctl.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/file.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/unistd.h>
 #include <gio/gio.h>
-#include <glib-unix.h>
 
 #include "basic.h"
 #include "lidManager.h"
 #include "button.h"
+#include "switchRegistry.h"
 #include "power.h"
-
-typedef void (*handler_func)(const LidManager* lidManager);
-
+#include "display.h"
+#include "action.h"
+#include "session.h"
+#include "inhibitor.h"
+#include "capabilities.h"
+#include "logind.h"
+#include "settings.h"
+#include "eventLoop.h"
+#include "latency.h"
+#include "policy.h"
+#include "recorder.h"
+#include "service.h"
+#include "wake.h"
+
+// Monotonic timestamps of the startup milestones, reported once the daemon can act on lid events
+static struct {
+    gint64 start;
+    gint64 discovered;
+    gint64 connected;
+    bool reported;
+} startup;
+
+static guint watcher_id;
+// Session instances follow the system-wide instance's bus name, to step aside when it starts later
+static guint system_instance_watcher_id;
+// Pid file of the system-wide instance, locked while it runs
+static int system_instance_fd = -1;
+
+// Pid of the system-wide instance
+#define SYSTEM_INSTANCE_FILE SETTINGS_PROFILE_DIR "/system.pid"
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
 static gboolean sig_int_handler(gpointer user_data) {
-    LidManager* lidManager = (LidManager*) user_data;
-    g_main_loop_quit(lidManager->loop);
-
-    return G_SOURCE_CONTINUE;
-}
+#pragma clang diagnostic pop
 
-static void handler_nothing(const LidManager* lidManager) {
-}
+    eventLoop_quit();
 
-/**
- * Lock
- *
- * @param lidManager
- */
-static void handler_lock(const LidManager* lidManager) {
-    GDBusConnection *connection = lidManager->connection;
-    GError *error = NULL;
-
-    GVariant *parameters = g_variant_new("()");
-    GVariant *result = g_dbus_connection_call_sync(
-            connection,
-            "org.freedesktop.login1",
-            "/org/freedesktop/login1",
-            "org.freedesktop.login1.Manager",
-            "ListSessions",
-            parameters,
-            NULL,
-            G_DBUS_CALL_FLAGS_NONE,
-            10 * 1000,
-            NULL,
-            &error);
-    if (!error) {
-        GVariant *array = g_variant_get_child_value(result, 0);
-        GVariantIter *arrayIter = g_variant_iter_new(array);
-        char *session_name;
-        guint32 session_uid;
-        char *session_user;
-        char *session_seat;
-        char *session_path;
-        int found_session = 0;
-
-        __uid_t uid = getuid();
-
-        while (g_variant_iter_loop(arrayIter, "(susso)", &session_name, &session_uid, &session_user, &session_seat,
-                                   &session_path)) {
-            if (uid == session_uid) {
-                // Found our session
-                found_session = 1;
-                break;
-            }
-        }
-
-        if (found_session) {
-            parameters = g_variant_new("(s)", session_name);
-            GVariant *result2 = g_dbus_connection_call_sync(
-                    connection,
-                    "org.freedesktop.login1",
-                    "/org/freedesktop/login1",
-                    "org.freedesktop.login1.Manager",
-                    "LockSession",
-                    parameters,
-                    NULL,
-                    G_DBUS_CALL_FLAGS_NONE,
-                    10 * 1000,
-                    NULL,
-                    &error);
-            if (result2) {
-                g_variant_unref(result2);
-            }
-        }
-
-        g_variant_iter_free(arrayIter);
-        g_variant_unref(array);
-        g_variant_unref(result);
-    }
+    return G_SOURCE_CONTINUE;
 }
 
-/**
- * Lock and suspend.
- *
- * @param lidManager
- */
-static void handler_suspend(const LidManager* lidManager) {
-    GDBusConnection *connection = lidManager->connection;
-    GError *error = NULL;
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+static gboolean sig_usr1_handler(gpointer user_data) {
+#pragma clang diagnostic pop
 
-    GVariant *parameters = g_variant_new("(b)", FALSE);
-    GVariant *result = g_dbus_connection_call_sync(
-            connection,
-            "org.freedesktop.login1",
-            "/org/freedesktop/login1",
-            "org.freedesktop.login1.Manager",
-            "Suspend",
-            parameters,
-            NULL,
-            G_DBUS_CALL_FLAGS_NONE,
-            10 * 1000,
-            NULL,
-            &error);
-    if (result) {
-        g_variant_unref(result);
+    int r = recorder_dump();
+    if (r < 0) {
+        fprintf(stderr, "Unable to write %s: %s\n", recorder_path(), strerror(-r));
+    } else {
+        fprintf(stderr, "Flight recorder written to %s\n", recorder_path());
     }
-}
 
-/**
- * Shutdown
- *
- * @param lidManager
- */
-static void handler_shutdown(const LidManager* lidManager) {
-    GDBusConnection *connection = lidManager->connection;
-    GError *error = NULL;
-
-    GVariant *parameters = g_variant_new("(b)", FALSE);
-    GVariant *result = g_dbus_connection_call_sync(
-            connection,
-            "org.freedesktop.login1",
-            "/org/freedesktop/login1",
-            "org.freedesktop.login1.Manager",
-            "PowerOff",
-            parameters,
-            NULL,
-            G_DBUS_CALL_FLAGS_NONE,
-            10 * 1000,
-            NULL,
-            &error);
-    if (result) {
-        g_variant_unref(result);
-    }
+    return G_SOURCE_CONTINUE;
 }
 
-/**
- * Hibernate
- *
- * @param lidManager
- */
-static void handler_hibernate(const LidManager* lidManager) {
-    handler_lock(lidManager);
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+static gboolean sig_usr2_handler(gpointer user_data) {
+#pragma clang diagnostic pop
 
-    GDBusConnection *connection = lidManager->connection;
-    GError *error = NULL;
+    // Registered before the manager exists
+    const LidManager* lidManager = *(LidManager**) user_data;
 
-    GVariant *parameters = g_variant_new("(b)", FALSE);
-    GVariant *result = g_dbus_connection_call_sync(
-            connection,
-            "org.freedesktop.login1",
-            "/org/freedesktop/login1",
-            "org.freedesktop.login1.Manager",
-            "Hibernate",
-            parameters,
-            NULL,
-            G_DBUS_CALL_FLAGS_NONE,
-            10 * 1000,
-            NULL,
-            &error);
-    if (result) {
-        g_variant_unref(result);
+    latency_dump(stderr);
+    if (lidManager) {
+        fprintf(stderr, "Lid close actions suppressed by the hold-off: %u\n", lidManager->policy->suppressed);
     }
-}
-
-/**
- * Logout
- *
- * @param lidManager
- */
-static void handler_logout(const LidManager* lidManager) {
-}
-
-static void lidManager_handler_impl(const LidManager* lidManager) {
-    bool ac_connected = ((lidManager->power == NULL) || lidManager->power->ac_connected);
-    bool lid_closed = (lidManager->button && lidManager->button->lid_closed);
-
-    if (lid_closed) {
-        char* dconf_key = NULL;
-        if (ac_connected) {
-            dconf_key = "/org/gnome/settings-daemon/plugins/power/lid-close-ac-action";
-        } else {
-            dconf_key = "/org/gnome/settings-daemon/plugins/power/lid-close-battery-action";
-        }
-
-        DConfClient* dconf_client = dconf_client_new();
-        GVariant* dconf_value = dconf_client_read(dconf_client, dconf_key);
-        if (!dconf_value) {
-            return;
-        }
-
-        gsize size;
-        const gchar* value = g_variant_get_string(dconf_value, &size);
-        if (!value) {
-            return;
-        }
 
-        handler_func handler = NULL;
-
-        if (strcmp(value, "blank") == 0) {
-            // Blank is treated as lock because there is no "lock"
-            handler = handler_lock;
-        } else if (strcmp(value, "suspend") == 0) {
-            handler = handler_suspend;
-        } else if (strcmp(value, "shutdown") == 0) {
-            handler = handler_shutdown;
-        } else if (strcmp(value, "hibernate") == 0) {
-            handler = handler_hibernate;
-        } else if (strcmp(value, "logout") == 0) {
-            handler = handler_logout;
-        } else {
-            handler = handler_nothing;
-        }
-
-        g_variant_unref(dconf_value);
-        g_object_unref(dconf_client);
-
-        handler(lidManager);
-    }
+    return G_SOURCE_CONTINUE;
 }
 
-int find_lid(LidManager *lidManager) {
+int find_switches(LidManager *lidManager) {
     _cleanup_(udev_enumerate_unrefp) struct udev_enumerate *e = NULL;
     int r;
 
@@ -269,75 +125,128 @@ int find_lid(LidManager *lidManager) {
         if (!d)
             return -1;
 
-        const char* name = udev_device_get_sysname(d);
-        Button* button;
-        if (button_create(lidManager, &button, name, lidManager_handler_impl) >= 0) {
-            lidManager->button = button;
-            break;
+        if (!lidManager_on_seat(lidManager, d)) {
+            continue;
         }
+
+        const char* name = udev_device_get_sysname(d);
+        switchRegistry_open_device(lidManager->switches, name);
     }
 
-    return (lidManager->button)? 1 : 0;
+    return switchRegistry_size(lidManager->switches);
 }
 
 int find_ac_adapter(LidManager* lidManager) {
-    _cleanup_(closedirp) DIR *d = NULL;
-    struct dirent *de;
+    Power* power = NULL;
 
-    d = opendir("/sys/class/power_supply");
-    if (!d) {
-        return -ENOENT;
+    int r = power_create(lidManager, &power, lidManager->handler);
+    if (r < 0) {
+        return r;
     }
 
-    int errno;
-    FOREACH_DIRENT(de, d, return -EIO) {
-            _cleanup_(closep) int fd, device;
-            char contents[6];
-            ssize_t n;
-
-            device = openat(dirfd(d), de->d_name, O_DIRECTORY|O_RDONLY|O_CLOEXEC|O_NOCTTY);
-            if (device < 0) {
-                return -ENOENT;
-            }
-
-            fd = openat(device, "type", O_RDONLY|O_CLOEXEC|O_NOCTTY);
-            if (fd < 0) {
-                continue;
-            }
-
-            n = read(fd, contents, sizeof(contents));
-            if (n < 0) {
-                return -EIO;
-            }
-
-            close(fd);
-
-            if (n != 6 || memcmp(contents, "Mains\n", 6) != 0)
-                continue;
-
-            fd = openat(device, "online", O_RDONLY|O_CLOEXEC|O_NOCTTY);
-            if (fd < 0) {
-                return -1;
-            }
-
-            // Create the directory path
-            const char* dirName = de->d_name;
-            const char* dirPrefix = "/sys/class/power_supply/";
-            const size_t len = strlen(dirPrefix) + strlen(dirName) + 1;
-            _cleanup_(freep) char* dirPath = malloc(len);
-            memset(dirPath, 0, len);
-            memcpy(dirPath, dirPrefix, strlen(dirPrefix));
-            memcpy(&dirPath[strlen(dirPrefix)], dirName, strlen(dirName));
-
-            // Found a mains supply
-            Power* power = NULL;
-            if (power_create(lidManager, &power, dirName, dirPath, lidManager_handler_impl) >= 0) {
-                lidManager->power = power;
-                break;
-            }
+    lidManager->power = power;
+
+    return g_hash_table_size(power->supplies);
+}
+
+int find_displays(LidManager* lidManager) {
+    Display* display = NULL;
+
+    int r = display_create(lidManager, &display, lidManager->handler);
+    if (r < 0) {
+        return r;
+    }
+
+    lidManager->display = display;
+
+    return display->external_count;
+}
+
+/**
+ * Decide on the new state, then publish it along with the decision's effect on the statistics.
+ */
+static void on_state_changed(const LidManager* lidManager) {
+    policy_evaluate(lidManager);
+
+    if (lidManager->service) {
+        service_update(lidManager->service);
+    }
+}
+
+static void on_session_ready(const LidManager* lidManager) {
+    if (!startup.reported) {
+        const gint64 ready = g_get_monotonic_time();
+        fprintf(stderr, "Ready after %.1f ms (devices %.1f ms, logind %.1f ms, session %.1f ms)\n",
+                (ready - startup.start) / 1000.0,
+                (startup.discovered - startup.start) / 1000.0,
+                (startup.connected - startup.start) / 1000.0,
+                (ready - startup.connected) / 1000.0);
+        startup.reported = true;
+    }
+
+    if (lidManager->seat) {
+        // The active session changed hands, act on its owner's settings
+        if (lidManager->session->path) {
+            settings_set_user(lidManager->settings, lidManager->session->uid);
+        } else {
+            settings_set_user(lidManager->settings, (uid_t) -1);
         }
+        policy_compile(lidManager->policy);
+    }
+
+    // Replays the latest decision taken while logind was not reachable
+    actionQueue_set_ready(lidManager->actions, true);
+}
+
+/**
+ * Leave the lid to the system-wide instance when one is running. It holds an exclusive lock on its pid file for
+ * as long as it runs, which works across users unlike signalling its pid.
+ */
+static bool system_instance_running(void) {
+    _cleanup_(closep) int fd = open(SYSTEM_INSTANCE_FILE, O_RDONLY|O_CLOEXEC|O_NOCTTY);
+    if (fd < 0) {
+        return false;
+    }
+
+    return flock(fd, LOCK_SH|LOCK_NB) < 0 && errno == EWOULDBLOCK;
+}
 
-    return errno;
+/**
+ * Take the pid file lock, kept until the process exits.
+ */
+static void system_instance_register(void) {
+    mkdir(SETTINGS_PROFILE_DIR, 0755);
+
+    system_instance_fd = open(SYSTEM_INSTANCE_FILE, O_RDWR|O_CREAT|O_CLOEXEC|O_NOCTTY, 0644);
+    if (system_instance_fd >= 0 && flock(system_instance_fd, LOCK_EX|LOCK_NB) < 0) {
+        close(system_instance_fd);
+        system_instance_fd = -1;
+    }
+    if (system_instance_fd < 0) {
+        fprintf(stderr, "Unable to lock %s, session instances will not step aside\n", SYSTEM_INSTANCE_FILE);
+        return;
+    }
+
+    char contents[16];
+    const int len = snprintf(contents, sizeof(contents), "%d\n", (int) getpid());
+    if (ftruncate(system_instance_fd, 0) < 0 || write(system_instance_fd, contents, len) != len) {
+        fprintf(stderr, "Unable to write %s\n", SYSTEM_INSTANCE_FILE);
+    }
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+static void on_system_instance_appeared(GDBusConnection *connection,
+                                        const gchar     *name,
+                                        const gchar     *name_owner,
+                                        gpointer         user_data) {
+#pragma clang diagnostic pop
+
+    // The name only tells something owns it, the lock tells it is the system-wide instance of this machine
+    if (system_instance_running()) {
+        fprintf(stderr, "A system-wide instance started, leaving the lid to it\n");
+        eventLoop_quit();
+    }
 }
 
 void on_connected(GDBusConnection *connection,
@@ -347,65 +256,171 @@ void on_connected(GDBusConnection *connection,
     LidManager *lidManager = (LidManager*) user_data;
     lidManager->connection = connection;
 
-    GError *error = NULL;
+    if (!startup.connected) {
+        startup.connected = g_get_monotonic_time();
+    }
 
-    GVariant *parameters = g_variant_new("(ssss)", "handle-lid-switch", "ubuntu-lid-fixer", "user preference", "block");
-    g_dbus_connection_call_sync(
-            connection,
-            "org.freedesktop.login1",
-            "/org/freedesktop/login1",
-            "org.freedesktop.login1.Manager",
-            "Inhibit",
-            parameters,
-            NULL,
-            G_DBUS_CALL_FLAGS_NONE,
-            10 * 1000,
-            NULL,
-            &error);
-    if (error) {
-        g_dbus_connection_close_sync(connection, NULL, &error);
+    if (logind_attach(lidManager->logind, connection) < 0) {
+        return;
     }
+    inhibitor_attach(lidManager->inhibitor, connection);
+    capabilities_attach(lidManager->capabilities, connection);
+    session_attach(lidManager->session, connection, on_session_ready);
 }
 
 void on_disconnected(GDBusConnection *connection,
                      const gchar     *name,
                      gpointer         user_data) {
     LidManager *lidManager = (LidManager*) user_data;
+    actionQueue_set_ready(lidManager->actions, false);
     lidManager->connection = NULL;
-    g_main_loop_quit(lidManager->loop);
+    logind_detach(lidManager->logind);
+    inhibitor_detach(lidManager->inhibitor);
+    capabilities_detach(lidManager->capabilities);
+    policy_compile(lidManager->policy);
+    session_detach(lidManager->session);
+
+    // logind restarting keeps the bus, wait for it to come back
+    if (!connection || g_dbus_connection_is_closed(connection)) {
+        eventLoop_quit();
+    }
 }
 
-int main() {
-    LidManager* lidManager = NULL;
-    if (lidManager_new(&lidManager) < 0) {
-        goto exit;
-    }
+static void on_bus_ready(GObject* source, GAsyncResult* res, gpointer user_data) {
+    LidManager *lidManager = (LidManager*) user_data;
+    GError *error = NULL;
 
-    if (find_lid(lidManager) > 0) {
-        find_ac_adapter(lidManager);
+    GDBusConnection* connection = g_dbus_connection_new_for_address_finish(res, &error);
+    if (!connection) {
+        fprintf(stderr, "Unable to connect to the logind bus: %s\n", error->message);
+        g_error_free(error);
+        eventLoop_quit();
+        return;
     }
 
-    GMainLoop *loop = g_main_loop_new(NULL, FALSE);
-    lidManager->loop = loop;
+    watcher_id = g_bus_watch_name_on_connection(
+            connection,
+            LOGIND_BUS_NAME,
+            G_BUS_NAME_WATCHER_FLAGS_NONE,
+            on_connected,
+            on_disconnected,
+            lidManager,
+            NULL);
+    g_object_unref(connection);
+}
 
-    g_unix_signal_add(SIGINT, sig_int_handler, lidManager);
-    g_unix_signal_add(SIGTERM, sig_int_handler, lidManager);
+/**
+ * Watch logind on the system bus, or on the bus at $GNOME3_LID_BUS_ADDRESS (e.g. a private bus running
+ * tools/mockLogind.c).
+ *
+ * @param lidManager
+ */
+static void watch_logind(LidManager* lidManager) {
+    const char* address = getenv("GNOME3_LID_BUS_ADDRESS");
+
+    if (address) {
+        g_dbus_connection_new_for_address(
+                address,
+                G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT | G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                NULL,
+                NULL,
+                on_bus_ready,
+                lidManager);
+        return;
+    }
 
-    guint watcher_id = g_bus_watch_name(
+    watcher_id = g_bus_watch_name(
             G_BUS_TYPE_SYSTEM,
-            "org.freedesktop.login1",
+            LOGIND_BUS_NAME,
             G_BUS_NAME_WATCHER_FLAGS_NONE,
             on_connected,
             on_disconnected,
             lidManager,
             NULL);
-    g_main_loop_run(loop);
-    g_bus_unwatch_name(watcher_id);
+}
+
+int main(int argc, char** argv) {
+    LidManager* lidManager = NULL;
+    const char* seat = NULL;
+
+    startup.start = g_get_monotonic_time();
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--system") == 0) {
+            seat = (seat)? seat : "seat0";
+        } else if (strncmp(argv[i], "--seat=", 7) == 0) {
+            seat = argv[i] + 7;
+        } else {
+            fprintf(stderr, "Usage: %s [--system] [--seat=SEAT]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (seat) {
+        system_instance_register();
+    } else if (system_instance_running()) {
+        fprintf(stderr, "A system-wide instance handles the lid\n");
+        return 0;
+    } else {
+        system_instance_watcher_id = g_bus_watch_name(
+                G_BUS_TYPE_SYSTEM,
+                SERVICE_BUS_NAME,
+                G_BUS_NAME_WATCHER_FLAGS_NONE,
+                on_system_instance_appeared,
+                NULL,
+                NULL,
+                NULL);
+    }
+
+    recorder_init();
+
+    // Before anything can start a thread
+    eventLoop_add_signal(SIGINT, sig_int_handler, NULL);
+    eventLoop_add_signal(SIGTERM, sig_int_handler, NULL);
+    eventLoop_add_signal(SIGUSR1, sig_usr1_handler, NULL);
+    eventLoop_add_signal(SIGUSR2, sig_usr2_handler, &lidManager);
+
+    if (lidManager_new(&lidManager, on_state_changed, seat) < 0) {
+        goto exit;
+    }
+
+    // The system-wide instance is on the system bus, see startup/etc/dbus-1/system.d
+    lidManager->service = service_new(lidManager);
+    if (lidManager->service) {
+        service_open(lidManager->service, seat ? G_BUS_TYPE_SYSTEM : G_BUS_TYPE_SESSION);
+    }
+
+    lidManager->wake = wake_new(lidManager);
+    if (lidManager->wake) {
+        wake_open(lidManager->wake);
+    }
+
+    // The bus connection is set up by the GDBus worker thread while devices are discovered
+    watch_logind(lidManager);
+
+    // Watch for switch devices before scanning, so one appearing in between is not missed
+    switchRegistry_monitor(lidManager->switches);
+    find_switches(lidManager);
+    find_ac_adapter(lidManager);
+    find_displays(lidManager);
+    startup.discovered = g_get_monotonic_time();
+
+    eventLoop_run();
+    if (watcher_id) {
+        g_bus_unwatch_name(watcher_id);
+    }
 
     exit:
+    if (system_instance_watcher_id) {
+        g_bus_unwatch_name(system_instance_watcher_id);
+    }
     if (lidManager) {
         lidManager_close(lidManager);
     }
+    if (system_instance_fd >= 0) {
+        unlink(SYSTEM_INSTANCE_FILE);
+        close(system_instance_fd);
+    }
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,199 @@
+#include <malloc.h>
+#include <memory.h>
+#include <stdbool.h>
+
+#include "lidManager.h"
+#include "switchRegistry.h"
+#include "power.h"
+#include "display.h"
+#include "action.h"
+#include "settings.h"
+#include "capabilities.h"
+#include "eventLoop.h"
+#include "latency.h"
+#include "recorder.h"
+#include "policy.h"
+
+static unsigned policy_inputs(const LidManager* lidManager) {
+    const unsigned switches = switchRegistry_state(lidManager->switches);
+    unsigned inputs = 0;
+
+    if (switches & SWITCH_LID_CLOSED) {
+        inputs |= POLICY_LID_CLOSED;
+    }
+    if (switches & SWITCH_DOCKED) {
+        inputs |= POLICY_DOCKED;
+    }
+    if (!lidManager->power || power_ac_connected(lidManager->power)) {
+        inputs |= POLICY_AC_CONNECTED;
+    }
+    if (lidManager->display && display_external_connected(lidManager->display)) {
+        inputs |= POLICY_EXTERNAL_DISPLAY;
+    }
+    if (lidManager->power &&
+        power_battery_low(lidManager->power, settings_critical_battery_percent(lidManager->settings))) {
+        inputs |= POLICY_BATTERY_CRITICAL;
+    }
+
+    return inputs;
+}
+
+/**
+ * @param policy
+ * @param trace
+ * @param held How long the hold-off delayed the action, negative when it fired right away
+ */
+static void policy_fire(Policy* policy, const LatencyTrace* trace, gint64 held) {
+    const LidManager* lidManager = policy->manager;
+
+    const ActionType action = policy->decisions[policy_inputs(lidManager)];
+
+    latency_record(action, LATENCY_READ, trace->read - trace->event);
+    latency_record(action, LATENCY_DECISION, trace->decision - trace->event);
+    if (held >= 0) {
+        latency_record(action, LATENCY_HOLDOFF, held);
+    }
+    latency_record(action, LATENCY_LOOKUP, latency_now() - trace->decision);
+
+    policy->fired = true;
+    actionQueue_push(lidManager->actions, action, trace);
+}
+
+static gboolean policy_holdoff_expired(void* user_data) {
+    Policy* policy = (Policy*) user_data;
+
+    policy->holdoff_timer = 0;
+
+    // Shift the trace by the wait, so the lookup, call and total stages measure the work and not the hold-off
+    LatencyTrace trace = policy->trace;
+    const gint64 held = latency_now() - trace.decision;
+    trace.event += held;
+    trace.read += held;
+    trace.decision += held;
+
+    policy_fire(policy, &trace, held);
+
+    return G_SOURCE_REMOVE;
+}
+
+Policy* policy_new(const struct LidManager* manager) {
+    Policy* policy = malloc(sizeof(Policy));
+    if (!policy) {
+        return NULL;
+    }
+    memset(policy, 0, sizeof(Policy));
+
+    policy->manager = manager;
+    policy_compile(policy);
+
+    return policy;
+}
+
+/**
+ * Fill the decision table from the settings. A closed lid does nothing while docked or driving an external
+ * display, like logind's HandleLidSwitchDocked=ignore, otherwise it runs the action configured for the AC state.
+ * On a critical battery, locking or suspending would let the machine die with the lid closed, the critical action
+ * runs instead. Either way the action becomes the closest one logind can currently carry out.
+ *
+ * @param policy
+ */
+void policy_compile(Policy* policy) {
+    const Settings* settings = policy->manager->settings;
+
+    for (unsigned inputs = 0; inputs < POLICY_INPUT_COUNT; inputs++) {
+        ActionType action = ACTION_NOTHING;
+
+        if ((inputs & POLICY_LID_CLOSED) && !(inputs & (POLICY_DOCKED | POLICY_EXTERNAL_DISPLAY))) {
+            action = settings_lid_close_action(settings, inputs & POLICY_AC_CONNECTED);
+            if ((inputs & POLICY_BATTERY_CRITICAL) && (action == ACTION_LOCK || action == ACTION_SUSPEND)) {
+                action = settings_lid_close_critical_action(settings);
+            }
+            action = capabilities_resolve(policy->manager->capabilities, action);
+        }
+
+        policy->decisions[inputs] = action;
+    }
+
+    if (policy->manager->power) {
+        power_track_batteries(policy->manager->power, settings_critical_battery_percent(settings) > 0);
+    }
+}
+
+/**
+ * Decide what to do for the current lid, AC, dock and display state, called whenever any of them changes.
+ *
+ * A close only acts once the lid stayed closed for the hold-off, so a bouncing sensor or a half-closed lid
+ * does not cause a suspend/resume cycle. Edges during the hold-off are coalesced, and the action is looked up
+ * with the state at expiry. Once it has run, changes act right away.
+ *
+ * @param lidManager
+ */
+void policy_evaluate(const LidManager* lidManager) {
+    Policy* policy = lidManager->policy;
+    const unsigned inputs = policy_inputs(lidManager);
+
+    if (!settings_notifies(lidManager->settings) &&
+        (inputs & POLICY_LID_CLOSED) && !policy->holdoff_timer && !policy->fired) {
+        settings_refresh(lidManager->settings);
+        policy_compile(policy);
+    }
+
+    recorder_record(latency_now(), RECORDER_DECISION, (gint32) inputs, policy->decisions[inputs]);
+
+    if (policy->decisions[inputs] != ACTION_NOTHING) {
+        if (policy->holdoff_timer) {
+            return;
+        }
+
+        const LatencyTrace trace = latency_decide();
+        const guint holdoff = settings_lid_close_holdoff(lidManager->settings);
+
+        if (policy->fired || holdoff == 0) {
+            policy_fire(policy, &trace, -1);
+            return;
+        }
+
+        policy->trace = trace;
+        policy->holdoff_timer = eventLoop_add_timeout(holdoff, policy_holdoff_expired, policy);
+        recorder_record(trace.decision, RECORDER_HOLDOFF, (gint32) holdoff, 0);
+        if (!policy->holdoff_timer) {
+            policy_fire(policy, &trace, -1);
+        }
+    } else {
+        if (policy->holdoff_timer) {
+            eventLoop_remove(policy->holdoff_timer);
+            policy->holdoff_timer = 0;
+            if (!(inputs & POLICY_LID_CLOSED)) {
+                policy->suppressed++;
+                recorder_record(latency_now(), RECORDER_SUPPRESSED, 0, 0);
+            }
+        }
+        policy->fired = false;
+
+        actionQueue_cancel(lidManager->actions);
+    }
+}
+
+/**
+ * Forget the current close, so the next decision starts from scratch. Used after resume, together with
+ * dropping the decisions queued before sleep.
+ *
+ * @param policy
+ */
+void policy_reset(Policy* policy) {
+    if (policy->holdoff_timer) {
+        eventLoop_remove(policy->holdoff_timer);
+        policy->holdoff_timer = 0;
+    }
+    policy->fired = false;
+
+    actionQueue_cancel(policy->manager->actions);
+}
+
+void policy_close(Policy* policy) {
+    if (policy->holdoff_timer) {
+        eventLoop_remove(policy->holdoff_timer);
+    }
+
+    free(policy);
+}
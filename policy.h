@@ -0,0 +1,47 @@
+#ifndef SYSTEMD_LID_POLICY_H
+#define SYSTEMD_LID_POLICY_H
+
+#include <stdbool.h>
+#include <glib.h>
+
+#include "lidManager.h"
+#include "action.h"
+#include "latency.h"
+
+// Inputs of a decision, bits of the decision table index
+typedef enum PolicyInput {
+    POLICY_LID_CLOSED = 1 << 0,
+    POLICY_AC_CONNECTED = 1 << 1,
+    POLICY_DOCKED = 1 << 2,
+    POLICY_EXTERNAL_DISPLAY = 1 << 3,
+    // A discharging battery at or below the critical percentage
+    POLICY_BATTERY_CRITICAL = 1 << 4,
+    POLICY_INPUT_COUNT = 1 << 5,
+} PolicyInput;
+
+struct Policy;
+
+typedef struct Policy {
+    const struct LidManager* manager;
+
+    // Action for every combination of inputs, rebuilt when the settings change
+    ActionType decisions[POLICY_INPUT_COUNT];
+
+    // Running while a lid close waits out the hold-off
+    guint holdoff_timer;
+    // Event the pending action was decided for
+    LatencyTrace trace;
+    // Whether an action already ran for the current close
+    bool fired;
+
+    // Lid close actions dropped because the lid reopened during the hold-off
+    unsigned suppressed;
+} Policy;
+
+Policy* policy_new(const struct LidManager* manager);
+void policy_compile(Policy* policy);
+void policy_evaluate(const LidManager* lidManager);
+void policy_reset(Policy* policy);
+void policy_close(Policy* policy);
+
+#endif //SYSTEMD_LID_POLICY_H
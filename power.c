@@ -1,42 +1,222 @@
+#include <errno.h>
 #include <fcntl.h>
 #include <malloc.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <libudev.h>
 #include <asm/errno.h>
 #include <linux/input.h>
-#include <glib-unix.h>
 
 #include "basic.h"
 #include "lidManager.h"
 #include "power.h"
+#include "settings.h"
+#include "udevMonitor.h"
+#include "eventLoop.h"
+#include "latency.h"
+#include "recorder.h"
+
+static bool power_supply_is_external(const char* type) {
+    return strcmp(type, "Mains") == 0 ||
+           strncmp(type, "USB", 3) == 0 ||
+           strcmp(type, "Wireless") == 0 ||
+           strcmp(type, "BrickID") == 0;
+}
 
-static int detect_ac_connected(Power* power) {
-    _cleanup_(closedirp) DIR *sysDir = NULL;
+/**
+ * Batteries of the system, not those of peripherals like mice which report a device scope.
+ */
+static bool power_supply_is_battery(const char* type, const char* scope) {
+    return strcmp(type, "Battery") == 0 && !(scope && strcmp(scope, "Device") == 0);
+}
 
-    sysDir = opendir(power->sysPath);
-    if (!sysDir) {
-        return -ENOENT;
+static void power_supply_free(gpointer data) {
+    PowerSupply* supply = (PowerSupply*) data;
+
+    free(supply->name);
+    free(supply);
+}
+
+static void power_supply_set(Power* power, const char* name, bool online) {
+    PowerSupply* supply = g_hash_table_lookup(power->supplies, name);
+    if (!supply) {
+        supply = malloc(sizeof(PowerSupply));
+        supply->name = strdup(name);
+        supply->online = false;
+        g_hash_table_insert(power->supplies, supply->name, supply);
     }
 
-    _cleanup_(closep) int fd = openat(dirfd(sysDir), "online", O_RDONLY|O_CLOEXEC|O_NOCTTY);
-    if (!fd) {
-        fprintf(stderr, "Unable to open: %s/%s\n", power->sysPath, "online");
-        return -ENOENT;
+    if (supply->online != online) {
+        supply->online = online;
+        if (online) {
+            power->online_count++;
+        } else {
+            power->online_count--;
+        }
+    }
+}
+
+static void power_supply_remove(Power* power, const char* name) {
+    PowerSupply* supply = g_hash_table_lookup(power->supplies, name);
+    if (!supply) {
+        return;
+    }
+
+    if (supply->online) {
+        power->online_count--;
+    }
+    g_hash_table_remove(power->supplies, name);
+}
+
+static PowerBattery* power_battery_find(Power* power, const char* name) {
+    for (unsigned i = 0; i < power->battery_count; i++) {
+        if (strcmp(power->batteries[i].name, name) == 0) {
+            return &power->batteries[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Combine the batteries into one level, each weighted by its size like upower does, so a small second battery
+ * does not skew it. Without the size of every battery, the capacities are averaged.
+ */
+static void power_battery_aggregate(Power* power) {
+    guint64 sum = 0, weighted = 0, full = 0;
+    int known = 0;
+    bool sized = true;
+    bool discharging = false;
+
+    for (unsigned i = 0; i < power->battery_count; i++) {
+        const PowerBattery* battery = &power->batteries[i];
+        if (battery->capacity >= 0) {
+            sum += (guint64) battery->capacity;
+            weighted += (guint64) battery->capacity * battery->full;
+            full += battery->full;
+            sized = sized && battery->full > 0;
+            known++;
+        }
+        discharging = discharging || battery->discharging;
+    }
+
+    if (!known) {
+        power->battery_capacity = -1;
+    } else if (sized) {
+        power->battery_capacity = (int) (weighted / full);
+    } else {
+        power->battery_capacity = (int) (sum / known);
     }
+    power->battery_discharging = discharging;
+}
+
+/**
+ * Update a battery from its capacity and status, either of which may be missing from a uevent.
+ *
+ * @param power
+ * @param name Supply sysname
+ * @param capacity POWER_SUPPLY_CAPACITY or NULL
+ * @param status POWER_SUPPLY_STATUS or NULL
+ * @param full POWER_SUPPLY_ENERGY_FULL, POWER_SUPPLY_CHARGE_FULL or NULL
+ */
+static void power_battery_set(Power* power, const char* name, const char* capacity, const char* status,
+                              const char* full) {
+    PowerBattery* battery = power_battery_find(power, name);
+    if (!battery) {
+        const size_t len = strlen(name);
+        if (power->battery_count == POWER_BATTERY_MAX || len >= POWER_BATTERY_NAME_MAX) {
+            return;
+        }
+
+        battery = &power->batteries[power->battery_count++];
+        memcpy(battery->name, name, len + 1);
+        battery->capacity = -1;
+        battery->full = 0;
+        battery->discharging = false;
+    }
+
+    if (capacity) {
+        const int value = atoi(capacity);
+        battery->capacity = (value < 0)? 0 : (value > 100)? 100 : value;
+    }
+    if (status) {
+        battery->discharging = strcmp(status, "Discharging") == 0;
+    }
+    if (full) {
+        battery->full = g_ascii_strtoull(full, NULL, 10);
+    }
+
+    power_battery_aggregate(power);
+}
+
+static void power_battery_remove(Power* power, const char* name) {
+    PowerBattery* battery = power_battery_find(power, name);
+    if (!battery) {
+        return;
+    }
+
+    *battery = power->batteries[--power->battery_count];
+    power_battery_aggregate(power);
+}
 
-    char contents[5] = {};
-    ssize_t n;
+/**
+ * Read a sysfs attribute without its trailing newline.
+ *
+ * @param dir Directory fd of the device
+ * @param name Attribute name
+ * @param contents Buffer receiving the NUL terminated value
+ * @param size Size of the buffer
+ * @return Length of the value or a negative error
+ */
+static ssize_t power_read_attribute(int dir, const char* name, char* contents, size_t size) {
+    _cleanup_(closep) int fd = openat(dir, name, O_RDONLY|O_CLOEXEC|O_NOCTTY);
+    if (fd < 0) {
+        return -errno;
+    }
 
-    n = read(fd, contents, sizeof(contents));
+    ssize_t n = read(fd, contents, size - 1);
     if (n < 0) {
-        return -1;
+        return -errno;
+    }
+
+    if (n > 0 && contents[n - 1] == '\n') {
+        n--;
     }
+    contents[n] = 0;
 
-    if (n != 2 || contents[1] != '\n') {
-        return -1;
+    return n;
+}
+
+/**
+ * Apply one power_supply uevent and run the policy if the aggregate AC state changed, or the battery crossed the
+ * critical level. Capacity changes that do not cross it only update the battery.
+ *
+ * @param power
+ * @param uevent
+ */
+void power_supply_changed(Power* power, const PowerSupplyUevent* uevent) {
+    const guint critical = settings_critical_battery_percent(power->manager->settings);
+    const bool ac_connected = power_ac_connected(power);
+    const bool battery_low = power_battery_low(power, critical);
+    const gint64 now = latency_now();
+
+    if (strcmp(uevent->action, "remove") == 0) {
+        power_supply_remove(power, uevent->name);
+        power_battery_remove(power, uevent->name);
+        recorder_record(now, RECORDER_SUPPLY, -1, power_ac_connected(power));
+    } else if (uevent->type && uevent->online && power_supply_is_external(uevent->type)) {
+        power_supply_set(power, uevent->name, uevent->online[0] == '1');
+        recorder_record(now, RECORDER_SUPPLY, uevent->online[0] == '1', power_ac_connected(power));
+    } else if (power->track_batteries && uevent->type && power_supply_is_battery(uevent->type, uevent->scope)) {
+        power_battery_set(power, uevent->name, uevent->capacity, uevent->status,
+                          (uevent->energy_full)? uevent->energy_full : uevent->charge_full);
+        recorder_record(now, RECORDER_BATTERY, power->battery_capacity, power->battery_discharging);
     }
 
-    return (contents[0] == '1')? 1 : 0;
+    if (power_ac_connected(power) != ac_connected || power_battery_low(power, critical) != battery_low) {
+        latency_origin(now, now);
+        power->handler(power->manager);
+    }
 }
 
 #pragma clang diagnostic push
@@ -47,96 +227,246 @@ static gboolean ac_adapter_handler(gint fd, GIOCondition condition, void *user_d
     Power* power = (Power*) user_data;
 
     struct udev_device* device = udev_monitor_receive_device(power->udev_monitor);
-    if (device) {
-        const char* devName = udev_device_get_sysname(device);
-        if (devName && strcmp(devName, power->devName) == 0) {
-            power->ac_connected = (detect_ac_connected(power) == 1);
-            power->handler(power->manager);
-        }
-        udev_device_unref(device);
+    if (!device) {
+        return TRUE;
+    }
+
+    const PowerSupplyUevent uevent = {
+            .action = udev_device_get_action(device),
+            .name = udev_device_get_sysname(device),
+            .type = udev_device_get_property_value(device, "POWER_SUPPLY_TYPE"),
+            .scope = udev_device_get_property_value(device, "POWER_SUPPLY_SCOPE"),
+            .online = udev_device_get_property_value(device, "POWER_SUPPLY_ONLINE"),
+            .capacity = udev_device_get_property_value(device, "POWER_SUPPLY_CAPACITY"),
+            .status = udev_device_get_property_value(device, "POWER_SUPPLY_STATUS"),
+            .energy_full = udev_device_get_property_value(device, "POWER_SUPPLY_ENERGY_FULL"),
+            .charge_full = udev_device_get_property_value(device, "POWER_SUPPLY_CHARGE_FULL"),
+    };
+    if (uevent.action && uevent.name) {
+        power_supply_changed(power, &uevent);
     }
 
+    udev_device_unref(device);
+
     return TRUE;
 }
 
-Power* power_new(struct LidManager* lidManager, const char* devName, const char* sysPath, lidManager_handler handler) {
+/**
+ * Check whether the udev rule tagging external supplies is installed, in which case the uevents of other supplies
+ * can be filtered out by the kernel.
+ *
+ * @param power
+ */
+static bool power_supply_tagged(Power* power) {
+    _cleanup_(udev_enumerate_unrefp) struct udev_enumerate *e = NULL;
+
+    e = udev_enumerate_new(power->manager->udev);
+    if (!e)
+        return false;
+
+    if (udev_enumerate_add_match_subsystem(e, "power_supply") < 0)
+        return false;
+
+    if (udev_enumerate_add_match_tag(e, POWER_SUPPLY_TAG) < 0)
+        return false;
+
+    if (udev_enumerate_scan_devices(e) < 0)
+        return false;
+
+    return udev_enumerate_get_list_entry(e) != NULL;
+}
+
+Power* power_new(const struct LidManager* lidManager, lidManager_handler handler) {
     Power* power = malloc(sizeof(Power));
     memset(power, 0, sizeof(Power));
 
     power->manager = lidManager;
-    power->devName = strdup(devName);
-    power->sysPath = strdup(sysPath);
     power->handler = handler;
 
-    power->udev_fd = -1;
     power->udev_monitor = NULL;
     power->event_monitor = 0;
-    power->ac_connected = false;
+
+    power->supplies = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, power_supply_free);
+    power->online_count = 0;
+
+    power->battery_count = 0;
+    power->battery_capacity = -1;
+    power->battery_discharging = false;
 
     return power;
 }
 
 int power_open(Power* power) {
-    int r;
-    struct udev_monitor* udev_monitor = udev_monitor_new_from_netlink(power->manager->udev, "udev");
-    if (!udev_monitor) {
-        return -ENOMEM;
-    }
+    struct udev_monitor* udev_monitor = NULL;
 
-    r = udev_monitor_set_receive_buffer_size(udev_monitor, 1024*1024);
-    if (r < 0) {
-        return r;
-    }
+    power->tagged = power_supply_tagged(power);
+    power->track_batteries = settings_critical_battery_percent(power->manager->settings) > 0;
 
-    int fd_udev = udev_monitor_get_fd(udev_monitor);
+    int fd_udev = udevMonitor_open(power->manager->udev, "power_supply", (power->tagged)? POWER_SUPPLY_TAG : NULL,
+                                   &udev_monitor);
     if (fd_udev < 0) {
         return fd_udev;
     }
 
-    power->udev_fd = fd_udev;
+    power->udev_monitor = udev_monitor;
+    if (power->tagged && power->track_batteries) {
+        // Tag filters match any of the tags
+        udev_monitor_filter_add_match_tag(udev_monitor, POWER_BATTERY_TAG);
+        udev_monitor_filter_update(udev_monitor);
+    }
+    power->event_monitor = eventLoop_add_fd(fd_udev, ac_adapter_handler, power);
+
+    return 0;
+}
 
-    r = udev_monitor_filter_add_match_subsystem_devtype(udev_monitor,
-                                                        "power_supply",
-                                                        NULL);
-    if (r < 0) {
-        return r;
+/**
+ * Follow the system batteries or stop doing so, as the critical battery action is enabled or disabled. While they
+ * are not followed, the kernel drops their uevents when the udev rule is installed.
+ *
+ * @param power
+ * @param track
+ */
+void power_track_batteries(Power* power, bool track) {
+    if (power->track_batteries == track) {
+        return;
+    }
+    power->track_batteries = track;
+
+    if (power->tagged && power->udev_monitor) {
+        udev_monitor_filter_remove(power->udev_monitor);
+        udev_monitor_filter_add_match_subsystem_devtype(power->udev_monitor, "power_supply", NULL);
+        udev_monitor_filter_add_match_tag(power->udev_monitor, POWER_SUPPLY_TAG);
+        if (track) {
+            udev_monitor_filter_add_match_tag(power->udev_monitor, POWER_BATTERY_TAG);
+        }
+        udev_monitor_filter_update(power->udev_monitor);
     }
 
-    r = udev_monitor_enable_receiving(udev_monitor);
-    if (r < 0) {
-        return r;
+    power->battery_count = 0;
+    power_battery_aggregate(power);
+    if (track) {
+        power_scan(power);
     }
+}
 
-    power->udev_monitor = udev_monitor;
-    power->event_monitor = g_unix_fd_add(fd_udev, G_IO_IN, ac_adapter_handler, power);
+/**
+ * Read the capacity and status of a system battery, at startup and after resume only.
+ */
+static void power_scan_battery(Power* power, int device, const char* name) {
+    char scope[32], capacity[32], status[32], full[32];
+
+    if (power_read_attribute(device, "scope", scope, sizeof(scope)) > 0 && strcmp(scope, "Device") == 0) {
+        return;
+    }
+
+    const bool sized = power_read_attribute(device, "energy_full", full, sizeof(full)) > 0 ||
+                       power_read_attribute(device, "charge_full", full, sizeof(full)) > 0;
+
+    power_battery_set(power, name,
+                      (power_read_attribute(device, "capacity", capacity, sizeof(capacity)) > 0)? capacity : NULL,
+                      (power_read_attribute(device, "status", status, sizeof(status)) > 0)? status : NULL,
+                      (sized)? full : NULL);
+}
+
+/**
+ * Register every external supply and system battery present in sysfs. The online state is only read for supplies
+ * that are kept.
+ *
+ * @param power
+ */
+int power_scan(Power* power) {
+    _cleanup_(closedirp) DIR *d = NULL;
+    struct dirent *de;
+
+    d = opendir(power->manager->power_supply_dir);
+    if (!d) {
+        return -ENOENT;
+    }
+
+    FOREACH_DIRENT(de, d, return -EIO) {
+            if (de->d_name[0] == '.') {
+                continue;
+            }
+
+            _cleanup_(closep) int device = openat(dirfd(d), de->d_name, O_DIRECTORY|O_RDONLY|O_CLOEXEC|O_NOCTTY);
+            if (device < 0) {
+                continue;
+            }
+
+            char contents[32];
+            if (power_read_attribute(device, "type", contents, sizeof(contents)) < 0) {
+                continue;
+            }
+
+            if (strcmp(contents, "Battery") == 0) {
+                if (power->track_batteries) {
+                    power_scan_battery(power, device, de->d_name);
+                }
+                continue;
+            }
+
+            if (!power_supply_is_external(contents)) {
+                continue;
+            }
+
+            bool online = (power_read_attribute(device, "online", contents, sizeof(contents)) > 0 &&
+                           contents[0] == '1');
+            power_supply_set(power, de->d_name, online);
+        }
 
     return 0;
 }
 
+/**
+ * Drop the queued uevents and re-read every supply, without running the handler.
+ *
+ * @param power
+ */
+int power_snapshot(Power* power) {
+    struct udev_device* device;
+
+    while ((device = udev_monitor_receive_device(power->udev_monitor))) {
+        udev_device_unref(device);
+    }
+
+    g_hash_table_remove_all(power->supplies);
+    power->online_count = 0;
+    power->battery_count = 0;
+    power_battery_aggregate(power);
+
+    return power_scan(power);
+}
+
 void power_close(Power* power) {
     if (power->event_monitor) {
-        g_source_remove(power->event_monitor);
+        eventLoop_remove(power->event_monitor);
     }
-    if (power->udev_fd > 0) {
-        close(power->udev_fd);
+    if (power->udev_monitor) {
+        udev_monitor_unref(power->udev_monitor);
     }
 
+    g_hash_table_unref(power->supplies);
+
     free(power);
 }
 
-int power_create(struct LidManager* lidManager, Power** pPower, const char* devName, const char* sysPath, lidManager_handler handler) {
+int power_create(const struct LidManager* lidManager, Power** pPower, lidManager_handler handler) {
     int r;
-    Power* power = power_new(lidManager, devName, sysPath, handler);
+    Power* power = power_new(lidManager, handler);
     if (!power) {
         return -ENOMEM;
     }
 
+    // Monitor before scanning so a supply changing in between is not missed
     r = power_open(power);
     if (r < 0) {
         goto fail;
     }
 
-    power->ac_connected = (detect_ac_connected(power) == 1);
+    r = power_scan(power);
+    if (r < 0) {
+        goto fail;
+    }
 
     *pPower = power;
 
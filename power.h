@@ -5,24 +5,93 @@
 
 #include "lidManager.h"
 
+#define POWER_SUPPLY_TAG "gnome3-lid-ac"
+#define POWER_BATTERY_TAG "gnome3-lid-battery"
+
+// System batteries tracked, further ones are ignored
+#define POWER_BATTERY_MAX 4
+#define POWER_BATTERY_NAME_MAX 32
+
 struct Power;
+struct PowerSupply;
+
+typedef struct PowerSupply {
+    char* name;
+    bool online;
+} PowerSupply;
+
+typedef struct PowerBattery {
+    char name[POWER_BATTERY_NAME_MAX];
+    // Percent, -1 until known
+    int capacity;
+    // energy_full (uWh) or charge_full (uAh), 0 when unknown
+    guint64 full;
+    bool discharging;
+} PowerBattery;
+
+// Properties of one power_supply uevent, NULL when absent
+typedef struct PowerSupplyUevent {
+    const char* action;
+    const char* name;
+    const char* type;
+    const char* scope;
+    const char* online;
+    const char* capacity;
+    const char* status;
+    const char* energy_full;
+    const char* charge_full;
+} PowerSupplyUevent;
 
 typedef struct Power {
     const struct LidManager* manager;
-    const char* devName;
-    const char* sysPath;
     lidManager_handler handler;
 
-    int udev_fd;
     struct udev_monitor* udev_monitor;
     guint event_monitor;
 
-    bool ac_connected;
+    // name -> PowerSupply, external supplies only
+    GHashTable* supplies;
+    unsigned online_count;
+    // The udev rule is installed, the kernel filters the uevents by tag
+    bool tagged;
+
+    // Batteries are only followed while the critical battery action is enabled
+    bool track_batteries;
+    // Updated in place from uevents, nothing is allocated or read from sysfs after the scan
+    PowerBattery batteries[POWER_BATTERY_MAX];
+    unsigned battery_count;
+    // Known capacities weighted by each battery's full energy or charge, -1 if none is
+    int battery_capacity;
+    bool battery_discharging;
 } Power;
 
-Power* power_new(struct LidManager* lidManager, const char* devName, const char* sysPath, lidManager_handler handler);
+Power* power_new(const struct LidManager* lidManager, lidManager_handler handler);
 int power_open(Power* power);
+int power_scan(Power* power);
+int power_snapshot(Power* power);
+void power_supply_changed(Power* power, const PowerSupplyUevent* uevent);
+void power_track_batteries(Power* power, bool track);
 void power_close(Power* power);
-int power_create(struct LidManager* lidManager, Power** pPower, const char* devName, const char* sysPath, lidManager_handler handler);
+int power_create(const struct LidManager* lidManager, Power** pPower, lidManager_handler handler);
+
+/**
+ * Systems without any external supply are treated as being on AC.
+ *
+ * @param power
+ */
+static inline bool power_ac_connected(const Power* power) {
+    return power->online_count > 0 || g_hash_table_size(power->supplies) == 0;
+}
+
+/**
+ * Whether a discharging battery is at or below the given percentage. 0 never matches.
+ *
+ * @param power
+ * @param percent
+ */
+static inline bool power_battery_low(const Power* power, guint percent) {
+    return percent > 0 && power->battery_discharging &&
+           power->battery_capacity >= 0 && (guint) power->battery_capacity <= percent;
+}
 
 #endif //SYSTEMD_LID_POWER_H
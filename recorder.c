@@ -0,0 +1,143 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "recorder.h"
+#include "settings.h"
+
+RecorderEntry recorder_entries[RECORDER_SIZE];
+guint64 recorder_next;
+
+// Resolved up front, the dump has to work from a crash handler
+static char path[256];
+
+static const char* event_names[RECORDER_EVENT_COUNT] = {
+        [RECORDER_SWITCH] = "switch",
+        [RECORDER_SWITCH_DEVICE] = "switch-device",
+        [RECORDER_SUPPLY] = "supply",
+        [RECORDER_BATTERY] = "battery",
+        [RECORDER_DISPLAY] = "display",
+        [RECORDER_DECISION] = "decision",
+        [RECORDER_HOLDOFF] = "holdoff",
+        [RECORDER_SUPPRESSED] = "suppressed",
+        [RECORDER_CALL] = "call",
+        [RECORDER_REPLY] = "reply",
+        [RECORDER_SLEEP] = "sleep",
+};
+
+static const int crash_signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+
+/**
+ * Append a decimal number, zero padded to width. Async-signal-safe.
+ */
+static size_t recorder_format_number(char* buffer, gint64 value, unsigned width) {
+    char digits[24];
+    size_t n = 0, length = 0;
+    guint64 magnitude = (value < 0)? (guint64) -value : (guint64) value;
+
+    do {
+        digits[n++] = (char) ('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude || n < width);
+
+    if (value < 0) {
+        buffer[length++] = '-';
+    }
+    while (n) {
+        buffer[length++] = digits[--n];
+    }
+
+    return length;
+}
+
+static size_t recorder_format_string(char* buffer, const char* string) {
+    size_t length = strlen(string);
+
+    memcpy(buffer, string, length);
+
+    return length;
+}
+
+/**
+ * One line: milliseconds, event name and both arguments.
+ */
+static size_t recorder_format(char* buffer, const RecorderEntry* entry) {
+    size_t length = 0;
+    const char* name = (entry->event < RECORDER_EVENT_COUNT)? event_names[entry->event] : "unknown";
+
+    length += recorder_format_number(buffer + length, entry->time / 1000000, 1);
+    buffer[length++] = '.';
+    length += recorder_format_number(buffer + length, (entry->time / 1000) % 1000, 3);
+    buffer[length++] = ' ';
+    length += recorder_format_string(buffer + length, name);
+    buffer[length++] = ' ';
+    length += recorder_format_number(buffer + length, entry->a, 1);
+    buffer[length++] = ' ';
+    length += recorder_format_number(buffer + length, entry->b, 1);
+    buffer[length++] = '\n';
+
+    return length;
+}
+
+/**
+ * Write the recorded events, oldest first, to recorder_path(). Async-signal-safe.
+ *
+ * @return 0 or a negative error
+ */
+int recorder_dump(void) {
+    char line[128];
+
+    int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC|O_NOCTTY, 0600);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    const guint64 next = recorder_next;
+    const guint64 first = (next > RECORDER_SIZE)? next - RECORDER_SIZE : 0;
+
+    for (guint64 i = first; i < next; i++) {
+        size_t length = recorder_format(line, &recorder_entries[i & (RECORDER_SIZE - 1)]);
+        if (write(fd, line, length) < 0) {
+            break;
+        }
+    }
+
+    close(fd);
+
+    return 0;
+}
+
+static void recorder_crash_handler(int signum) {
+    recorder_dump();
+
+    // SA_RESETHAND restored the default action
+    raise(signum);
+}
+
+const char* recorder_path(void) {
+    return path;
+}
+
+/**
+ * Pick the dump location and dump on fatal signals.
+ */
+void recorder_init(void) {
+    const char* dir = getenv("XDG_RUNTIME_DIR");
+
+    // The system-wide instance has no runtime dir of its own
+    snprintf(path, sizeof(path), "%s/gnome3-lid-recorder.%d", (dir)? dir : SETTINGS_PROFILE_DIR, (int) getpid());
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = recorder_crash_handler;
+    action.sa_flags = SA_RESETHAND;
+    sigemptyset(&action.sa_mask);
+
+    for (size_t i = 0; i < sizeof(crash_signals) / sizeof(crash_signals[0]); i++) {
+        sigaction(crash_signals[i], &action, NULL);
+    }
+}
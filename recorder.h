@@ -0,0 +1,67 @@
+#ifndef SYSTEMD_LID_RECORDER_H
+#define SYSTEMD_LID_RECORDER_H
+
+#include <glib.h>
+
+// Entries kept, a power of two
+#define RECORDER_SIZE 4096
+
+typedef enum RecorderEvent {
+    // a: lid closed, b: docked, of one switch device
+    RECORDER_SWITCH = 0,
+    // a: 1 added, 0 removed, b: device fd
+    RECORDER_SWITCH_DEVICE,
+    // a: supply online, -1 when removed, b: aggregate AC state
+    RECORDER_SUPPLY,
+    // a: mean battery capacity or -1, b: discharging
+    RECORDER_BATTERY,
+    // a: connected external displays
+    RECORDER_DISPLAY,
+    // a: policy inputs, b: action decided
+    RECORDER_DECISION,
+    // a: hold-off in ms
+    RECORDER_HOLDOFF,
+    // Lid reopened during the hold-off
+    RECORDER_SUPPRESSED,
+    // a: action type, b: logind method, -1 for the lid open wake-up
+    RECORDER_CALL,
+    // a: action type, b: 0 or negative error
+    RECORDER_REPLY,
+    // a: 1 going to sleep, 0 resumed
+    RECORDER_SLEEP,
+    RECORDER_EVENT_COUNT,
+} RecorderEvent;
+
+typedef struct RecorderEntry {
+    // CLOCK_MONOTONIC, ns
+    gint64 time;
+    guint32 event;
+    gint32 a;
+    gint32 b;
+} RecorderEntry;
+
+extern RecorderEntry recorder_entries[RECORDER_SIZE];
+extern guint64 recorder_next;
+
+void recorder_init(void);
+const char* recorder_path(void);
+int recorder_dump(void);
+
+/**
+ * Record an event, overwriting the oldest one. Only called from the main loop.
+ *
+ * @param time Monotonic timestamp the caller already has, see latency_now()
+ * @param event
+ * @param a
+ * @param b
+ */
+static inline void recorder_record(gint64 time, RecorderEvent event, gint32 a, gint32 b) {
+    RecorderEntry* entry = &recorder_entries[recorder_next++ & (RECORDER_SIZE - 1)];
+
+    entry->time = time;
+    entry->event = event;
+    entry->a = a;
+    entry->b = b;
+}
+
+#endif //SYSTEMD_LID_RECORDER_H
@@ -0,0 +1,192 @@
+#include <errno.h>
+#include <malloc.h>
+#include <memory.h>
+
+#include "lidManager.h"
+#include "switchRegistry.h"
+#include "power.h"
+#include "display.h"
+#include "action.h"
+#include "policy.h"
+#include "service.h"
+
+static const char introspection_xml[] =
+        "<node>"
+        "  <interface name='" SERVICE_INTERFACE "'>"
+        "    <property name='LidClosed' type='b' access='read'/>"
+        "    <property name='OnAC' type='b' access='read'/>"
+        "    <property name='Docked' type='b' access='read'/>"
+        "    <property name='ExternalDisplay' type='b' access='read'/>"
+        "    <property name='LastAction' type='s' access='read'/>"
+        "    <property name='LastActionLatency' type='t' access='read'/>"
+        "    <property name='SuppressedActions' type='u' access='read'/>"
+        "  </interface>"
+        "</node>";
+
+static void service_read(const LidManager* lidManager, ServiceState* state) {
+    const unsigned switches = switchRegistry_state(lidManager->switches);
+
+    state->lid_closed = switches & SWITCH_LID_CLOSED;
+    state->docked = switches & SWITCH_DOCKED;
+    state->on_ac = !lidManager->power || power_ac_connected(lidManager->power);
+    state->external_display = lidManager->display && display_external_connected(lidManager->display);
+    state->last_action = lidManager->actions->last_type;
+    state->last_action_latency = (guint64) lidManager->actions->last_latency / 1000;
+    state->suppressed = lidManager->policy->suppressed;
+}
+
+static GVariant* service_property(const ServiceState* state, const char* name) {
+    if (strcmp(name, "LidClosed") == 0) {
+        return g_variant_new_boolean(state->lid_closed);
+    } else if (strcmp(name, "OnAC") == 0) {
+        return g_variant_new_boolean(state->on_ac);
+    } else if (strcmp(name, "Docked") == 0) {
+        return g_variant_new_boolean(state->docked);
+    } else if (strcmp(name, "ExternalDisplay") == 0) {
+        return g_variant_new_boolean(state->external_display);
+    } else if (strcmp(name, "LastAction") == 0) {
+        return g_variant_new_string(action_type_name(state->last_action));
+    } else if (strcmp(name, "LastActionLatency") == 0) {
+        return g_variant_new_uint64(state->last_action_latency);
+    } else if (strcmp(name, "SuppressedActions") == 0) {
+        return g_variant_new_uint32(state->suppressed);
+    }
+
+    return NULL;
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+static GVariant* service_get_property(GDBusConnection* connection, const gchar* sender, const gchar* object_path,
+                                      const gchar* interface_name, const gchar* property_name, GError** error,
+                                      gpointer user_data) {
+#pragma clang diagnostic pop
+
+    Service* service = (Service*) user_data;
+
+    GVariant* value = service_property(&service->state, property_name);
+    if (!value) {
+        g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_PROPERTY, "No property %s", property_name);
+    }
+
+    return value;
+}
+
+static const GDBusInterfaceVTable service_vtable = {
+        .get_property = service_get_property,
+};
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+static void service_bus_acquired(GDBusConnection* connection, const gchar* name, gpointer user_data) {
+#pragma clang diagnostic pop
+
+    Service* service = (Service*) user_data;
+    GError* error = NULL;
+
+    service_read(service->manager, &service->state);
+
+    service->registration_id = g_dbus_connection_register_object(connection, SERVICE_OBJECT_PATH,
+                                                                 service->info->interfaces[0], &service_vtable,
+                                                                 service, NULL, &error);
+    if (!service->registration_id) {
+        fprintf(stderr, "Unable to export %s: %s\n", SERVICE_OBJECT_PATH, error->message);
+        g_error_free(error);
+        return;
+    }
+
+    service->connection = connection;
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+static void service_name_lost(GDBusConnection* connection, const gchar* name, gpointer user_data) {
+#pragma clang diagnostic pop
+
+    // Keeps the object exported, another instance owning the name is the one clients talk to
+    fprintf(stderr, "Unable to own %s\n", name);
+}
+
+Service* service_new(const struct LidManager* manager) {
+    Service* service = malloc(sizeof(Service));
+    if (!service) {
+        return NULL;
+    }
+    memset(service, 0, sizeof(Service));
+
+    service->manager = manager;
+
+    service->info = g_dbus_node_info_new_for_xml(introspection_xml, NULL);
+    if (!service->info) {
+        free(service);
+        return NULL;
+    }
+
+    return service;
+}
+
+int service_open(Service* service, GBusType bus_type) {
+    service->owner_id = g_bus_own_name(bus_type, SERVICE_BUS_NAME, G_BUS_NAME_OWNER_FLAGS_NONE,
+                                       service_bus_acquired, NULL, service_name_lost, service, NULL);
+
+    return service->owner_id ? 0 : -EIO;
+}
+
+/**
+ * Compare the exported properties against the current state and announce the ones that differ in a single
+ * PropertiesChanged. Called on every state change, most of which leave the properties as they were.
+ *
+ * @param service
+ */
+void service_update(Service* service) {
+    static const char* const names[] = {
+            "LidClosed", "OnAC", "Docked", "ExternalDisplay", "LastAction", "LastActionLatency", "SuppressedActions",
+    };
+    ServiceState state;
+
+    if (!service->connection) {
+        return;
+    }
+
+    // Padding included, for the comparison below
+    memset(&state, 0, sizeof(ServiceState));
+    service_read(service->manager, &state);
+    if (memcmp(&state, &service->state, sizeof(ServiceState)) == 0) {
+        return;
+    }
+
+    GVariantBuilder changed;
+    g_variant_builder_init(&changed, G_VARIANT_TYPE("a{sv}"));
+
+    for (size_t i = 0; i < G_N_ELEMENTS(names); i++) {
+        GVariant* previous = service_property(&service->state, names[i]);
+        GVariant* current = service_property(&state, names[i]);
+
+        g_variant_ref_sink(previous);
+        if (!g_variant_equal(previous, current)) {
+            g_variant_builder_add(&changed, "{sv}", names[i], current);
+        } else {
+            g_variant_unref(g_variant_ref_sink(current));
+        }
+        g_variant_unref(previous);
+    }
+
+    service->state = state;
+
+    g_dbus_connection_emit_signal(service->connection, NULL, SERVICE_OBJECT_PATH,
+                                  "org.freedesktop.DBus.Properties", "PropertiesChanged",
+                                  g_variant_new("(sa{sv}as)", SERVICE_INTERFACE, &changed, NULL), NULL);
+}
+
+void service_close(Service* service) {
+    if (service->registration_id) {
+        g_dbus_connection_unregister_object(service->connection, service->registration_id);
+    }
+    if (service->owner_id) {
+        g_bus_unown_name(service->owner_id);
+    }
+
+    g_dbus_node_info_unref(service->info);
+
+    free(service);
+}
@@ -0,0 +1,45 @@
+#ifndef SYSTEMD_LID_SERVICE_H
+#define SYSTEMD_LID_SERVICE_H
+
+#include <stdbool.h>
+#include <gio/gio.h>
+
+#include "lidManager.h"
+#include "action.h"
+
+#define SERVICE_BUS_NAME "org.gnome3lid.Lid"
+#define SERVICE_OBJECT_PATH "/org/gnome3lid/Lid"
+#define SERVICE_INTERFACE "org.gnome3lid.Lid"
+
+struct Service;
+
+// Values of the exported properties
+typedef struct ServiceState {
+    bool lid_closed;
+    bool on_ac;
+    bool docked;
+    bool external_display;
+    ActionType last_action;
+    // Kernel event to the last reply of the last action, microseconds
+    guint64 last_action_latency;
+    guint suppressed;
+} ServiceState;
+
+typedef struct Service {
+    const struct LidManager* manager;
+
+    guint owner_id;
+    GDBusNodeInfo* info;
+    GDBusConnection* connection;
+    guint registration_id;
+
+    // As last sent, PropertiesChanged only carries what differs from it
+    ServiceState state;
+} Service;
+
+Service* service_new(const struct LidManager* manager);
+int service_open(Service* service, GBusType bus_type);
+void service_update(Service* service);
+void service_close(Service* service);
+
+#endif //SYSTEMD_LID_SERVICE_H
@@ -0,0 +1,432 @@
+#include <malloc.h>
+#include <memory.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "lidManager.h"
+#include "action.h"
+#include "session.h"
+
+static void session_set_path(Session* session, const char* path) {
+    free(session->path);
+    session->path = (path)? strdup(path) : NULL;
+}
+
+static void session_set_seat_path(Session* session, const char* path) {
+    free(session->seat_path);
+    session->seat_path = (path)? strdup(path) : NULL;
+}
+
+static void session_resolved(Session* session) {
+    if (session->ready_handler) {
+        session->ready_handler(session->manager);
+    }
+}
+
+static void session_get_session_reply(GObject* source, GAsyncResult* res, gpointer user_data) {
+    GError* error = NULL;
+
+    GVariant* result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        g_error_free(error);
+        return;
+    }
+
+    Session* session = (Session*) user_data;
+    if (result) {
+        const char* path;
+        g_variant_get(result, "(&o)", &path);
+        session_set_path(session, path);
+        g_variant_unref(result);
+    } else {
+        fprintf(stderr, "Unable to resolve logind session: %s\n", error->message);
+    }
+    g_clear_error(&error);
+
+    session_resolved(session);
+}
+
+static void session_get_session_by_pid_reply(GObject* source, GAsyncResult* res, gpointer user_data) {
+    GError* error = NULL;
+
+    GVariant* result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        g_error_free(error);
+        return;
+    }
+    g_clear_error(&error);
+
+    Session* session = (Session*) user_data;
+    if (result) {
+        const char* path;
+        g_variant_get(result, "(&o)", &path);
+        session_set_path(session, path);
+        g_variant_unref(result);
+        session_resolved(session);
+        return;
+    }
+
+    // Not running inside a session scope (e.g. started by hand), fall back to the session we were started from
+    const char* session_id = getenv("XDG_SESSION_ID");
+    if (!session_id) {
+        fprintf(stderr, "Unable to resolve logind session\n");
+        session_resolved(session);
+        return;
+    }
+
+    g_dbus_connection_call(
+            session->connection,
+            LOGIND_BUS_NAME,
+            LOGIND_OBJECT_PATH,
+            LOGIND_MANAGER_INTERFACE,
+            "GetSession",
+            g_variant_new("(s)", session_id),
+            G_VARIANT_TYPE("(o)"),
+            G_DBUS_CALL_FLAGS_NONE,
+            LOGIND_CALL_TIMEOUT,
+            session->cancellable,
+            session_get_session_reply,
+            session);
+}
+
+/**
+ * Look up the object path of the session this process belongs to.
+ *
+ * @param session
+ */
+static void session_resolve(Session* session) {
+    g_dbus_connection_call(
+            session->connection,
+            LOGIND_BUS_NAME,
+            LOGIND_OBJECT_PATH,
+            LOGIND_MANAGER_INTERFACE,
+            "GetSessionByPID",
+            g_variant_new("(u)", (guint32) getpid()),
+            G_VARIANT_TYPE("(o)"),
+            G_DBUS_CALL_FLAGS_NONE,
+            LOGIND_CALL_TIMEOUT,
+            session->cancellable,
+            session_get_session_by_pid_reply,
+            session);
+}
+
+static void session_get_user_reply(GObject* source, GAsyncResult* res, gpointer user_data) {
+    GError* error = NULL;
+
+    GVariant* result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        g_error_free(error);
+        return;
+    }
+
+    Session* session = (Session*) user_data;
+    if (result) {
+        GVariant* value;
+        guint32 uid;
+        g_variant_get(result, "(v)", &value);
+        g_variant_get(value, "(u&o)", &uid, NULL);
+        session->uid = (uid_t) uid;
+        g_variant_unref(value);
+        g_variant_unref(result);
+    } else {
+        fprintf(stderr, "Unable to resolve the owner of %s: %s\n", session->path, error->message);
+        session_set_path(session, NULL);
+    }
+    g_clear_error(&error);
+
+    session_resolved(session);
+}
+
+/**
+ * Follow a new active session of our seat and look up its owner.
+ *
+ * @param session
+ * @param path Object path of the session, "/" while nobody is logged in on the seat
+ */
+static void session_set_active(Session* session, const char* path) {
+    // logind reports "/" while nobody is logged in on the seat
+    session_set_path(session, (path && strcmp(path, "/") != 0)? path : NULL);
+
+    if (!session->path) {
+        session_resolved(session);
+        return;
+    }
+
+    g_dbus_connection_call(
+            session->connection,
+            LOGIND_BUS_NAME,
+            session->path,
+            "org.freedesktop.DBus.Properties",
+            "Get",
+            g_variant_new("(ss)", LOGIND_SESSION_INTERFACE, "User"),
+            G_VARIANT_TYPE("(v)"),
+            G_DBUS_CALL_FLAGS_NONE,
+            LOGIND_CALL_TIMEOUT,
+            session->cancellable,
+            session_get_user_reply,
+            session);
+}
+
+static void session_get_active_reply(GObject* source, GAsyncResult* res, gpointer user_data) {
+    GError* error = NULL;
+
+    GVariant* result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        g_error_free(error);
+        return;
+    }
+
+    Session* session = (Session*) user_data;
+    const char* path = NULL;
+    GVariant* value = NULL;
+    if (result) {
+        g_variant_get(result, "(v)", &value);
+        g_variant_get(value, "(&s&o)", NULL, &path);
+    } else {
+        fprintf(stderr, "Unable to resolve the active session: %s\n", error->message);
+    }
+    g_clear_error(&error);
+
+    session_set_active(session, path);
+    if (value) {
+        g_variant_unref(value);
+    }
+    if (result) {
+        g_variant_unref(result);
+    }
+}
+
+/**
+ * Look up the active session of our seat and its owner.
+ *
+ * @param session
+ */
+static void session_resolve_active(Session* session) {
+    g_dbus_connection_call(
+            session->connection,
+            LOGIND_BUS_NAME,
+            session->seat_path,
+            "org.freedesktop.DBus.Properties",
+            "Get",
+            g_variant_new("(ss)", LOGIND_SEAT_INTERFACE, "ActiveSession"),
+            G_VARIANT_TYPE("(v)"),
+            G_DBUS_CALL_FLAGS_NONE,
+            LOGIND_CALL_TIMEOUT,
+            session->cancellable,
+            session_get_active_reply,
+            session);
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+static void session_seat_changed_handler(GDBusConnection *connection,
+                                         const gchar *sender_name,
+                                         const gchar *object_path,
+                                         const gchar *interface_name,
+                                         const gchar *signal_name,
+                                         GVariant *parameters,
+                                         gpointer user_data) {
+#pragma clang diagnostic pop
+
+    Session* session = (Session*) user_data;
+    const char* changed_interface;
+    GVariant* changed;
+    const char** invalidated;
+
+    // Other seat properties such as IdleHint change far more often than the active session
+    g_variant_get(parameters, "(&s@a{sv}^a&s)", &changed_interface, &changed, &invalidated);
+    if (strcmp(changed_interface, LOGIND_SEAT_INTERFACE) == 0) {
+        const char* path = NULL;
+
+        if (g_variant_lookup(changed, "ActiveSession", "(&s&o)", NULL, &path)) {
+            const bool same = (strcmp(path, "/") == 0)? !session->path :
+                              (session->path && strcmp(session->path, path) == 0);
+            if (!same) {
+                session_set_active(session, path);
+            }
+        } else if (g_strv_contains(invalidated, "ActiveSession")) {
+            session_resolve_active(session);
+        }
+    }
+    g_variant_unref(changed);
+    g_free(invalidated);
+}
+
+static void session_get_seat_reply(GObject* source, GAsyncResult* res, gpointer user_data) {
+    GError* error = NULL;
+
+    GVariant* result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        g_error_free(error);
+        return;
+    }
+
+    Session* session = (Session*) user_data;
+    if (!result) {
+        fprintf(stderr, "Unable to resolve seat %s: %s\n", session->manager->seat, error->message);
+        g_clear_error(&error);
+        session_resolved(session);
+        return;
+    }
+
+    const char* path;
+    g_variant_get(result, "(&o)", &path);
+    session_set_seat_path(session, path);
+    g_variant_unref(result);
+
+    session->seat_changed_subscription = g_dbus_connection_signal_subscribe(
+            session->connection,
+            LOGIND_BUS_NAME,
+            "org.freedesktop.DBus.Properties",
+            "PropertiesChanged",
+            session->seat_path,
+            NULL,
+            G_DBUS_SIGNAL_FLAGS_NONE,
+            session_seat_changed_handler,
+            session,
+            NULL);
+
+    session_resolve_active(session);
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+static void session_new_handler(GDBusConnection *connection,
+                                const gchar *sender_name,
+                                const gchar *object_path,
+                                const gchar *interface_name,
+                                const gchar *signal_name,
+                                GVariant *parameters,
+                                gpointer user_data) {
+#pragma clang diagnostic pop
+
+    Session* session = (Session*) user_data;
+    if (!session->path) {
+        session_resolve(session);
+    }
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+static void session_removed_handler(GDBusConnection *connection,
+                                    const gchar *sender_name,
+                                    const gchar *object_path,
+                                    const gchar *interface_name,
+                                    const gchar *signal_name,
+                                    GVariant *parameters,
+                                    gpointer user_data) {
+#pragma clang diagnostic pop
+
+    Session* session = (Session*) user_data;
+    const char* session_id;
+    const char* session_path;
+
+    g_variant_get(parameters, "(&s&o)", &session_id, &session_path);
+    if (session->path && strcmp(session->path, session_path) == 0) {
+        session_set_path(session, NULL);
+    }
+}
+
+Session* session_new(const struct LidManager* manager) {
+    Session* session = malloc(sizeof(Session));
+    if (!session) {
+        return NULL;
+    }
+    memset(session, 0, sizeof(Session));
+
+    session->manager = manager;
+    session->connection = NULL;
+    session->path = NULL;
+
+    return session;
+}
+
+/**
+ * Start tracking our session on a logind connection, or the active session of the seat for the system-wide
+ * instance. The ready handler runs every time resolving the session finished, whether or not one was found.
+ *
+ * @param session
+ * @param connection
+ * @param ready_handler
+ */
+void session_attach(Session* session, GDBusConnection* connection, lidManager_handler ready_handler) {
+    session_detach(session);
+
+    session->connection = connection;
+    session->ready_handler = ready_handler;
+    session->cancellable = g_cancellable_new();
+
+    if (session->manager->seat) {
+        // The system-wide instance follows whichever session is active on its seat
+        g_dbus_connection_call(
+                connection,
+                LOGIND_BUS_NAME,
+                LOGIND_OBJECT_PATH,
+                LOGIND_MANAGER_INTERFACE,
+                "GetSeat",
+                g_variant_new("(s)", session->manager->seat),
+                G_VARIANT_TYPE("(o)"),
+                G_DBUS_CALL_FLAGS_NONE,
+                LOGIND_CALL_TIMEOUT,
+                session->cancellable,
+                session_get_seat_reply,
+                session);
+        return;
+    }
+
+    session->session_new_subscription = g_dbus_connection_signal_subscribe(
+            connection,
+            LOGIND_BUS_NAME,
+            LOGIND_MANAGER_INTERFACE,
+            "SessionNew",
+            LOGIND_OBJECT_PATH,
+            NULL,
+            G_DBUS_SIGNAL_FLAGS_NONE,
+            session_new_handler,
+            session,
+            NULL);
+    session->session_removed_subscription = g_dbus_connection_signal_subscribe(
+            connection,
+            LOGIND_BUS_NAME,
+            LOGIND_MANAGER_INTERFACE,
+            "SessionRemoved",
+            LOGIND_OBJECT_PATH,
+            NULL,
+            G_DBUS_SIGNAL_FLAGS_NONE,
+            session_removed_handler,
+            session,
+            NULL);
+
+    session_resolve(session);
+}
+
+void session_detach(Session* session) {
+    if (session->cancellable) {
+        g_cancellable_cancel(session->cancellable);
+        g_object_unref(session->cancellable);
+        session->cancellable = NULL;
+    }
+    if (session->session_new_subscription) {
+        g_dbus_connection_signal_unsubscribe(session->connection, session->session_new_subscription);
+        session->session_new_subscription = 0;
+    }
+    if (session->session_removed_subscription) {
+        g_dbus_connection_signal_unsubscribe(session->connection, session->session_removed_subscription);
+        session->session_removed_subscription = 0;
+    }
+    if (session->seat_changed_subscription) {
+        g_dbus_connection_signal_unsubscribe(session->connection, session->seat_changed_subscription);
+        session->seat_changed_subscription = 0;
+    }
+
+    session->connection = NULL;
+    session->ready_handler = NULL;
+    session_set_path(session, NULL);
+    session_set_seat_path(session, NULL);
+}
+
+void session_close(Session* session) {
+    session_detach(session);
+
+    free(session);
+}
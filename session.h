@@ -0,0 +1,37 @@
+#ifndef SYSTEMD_LID_SESSION_H
+#define SYSTEMD_LID_SESSION_H
+
+#include <sys/types.h>
+#include <gio/gio.h>
+
+#include "lidManager.h"
+
+#define LOGIND_SESSION_INTERFACE "org.freedesktop.login1.Session"
+#define LOGIND_SEAT_INTERFACE "org.freedesktop.login1.Seat"
+
+struct Session;
+
+typedef struct Session {
+    const struct LidManager* manager;
+    GDBusConnection* connection;
+    lidManager_handler ready_handler;
+
+    char* path;
+    // Owner of the session, only resolved for the system-wide instance
+    uid_t uid;
+
+    // Seat whose active session is followed by the system-wide instance
+    char* seat_path;
+
+    GCancellable* cancellable;
+    guint session_new_subscription;
+    guint session_removed_subscription;
+    guint seat_changed_subscription;
+} Session;
+
+Session* session_new(const struct LidManager* manager);
+void session_attach(Session* session, GDBusConnection* connection, lidManager_handler ready_handler);
+void session_detach(Session* session);
+void session_close(Session* session);
+
+#endif //SYSTEMD_LID_SESSION_H
@@ -0,0 +1,111 @@
+#ifndef SYSTEMD_LID_SETTINGS_H
+#define SYSTEMD_LID_SETTINGS_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+#ifdef GNOME3_LID_DCONF
+#include <dconf/dconf.h>
+#endif
+
+#include "lidManager.h"
+#include "action.h"
+
+/*
+ * Source of the lid close actions and hold-off. The dconf implementation (GNOME3_LID_DCONF) reads the GNOME power
+ * settings, the file implementation reads SETTINGS_FILE_NAME from SETTINGS_SYSTEM_DIR and then from the user's
+ * configuration directory, the latter winning. Both call policy_compile() when the settings change.
+ */
+
+#define SETTINGS_POWER_DIR "/org/gnome/settings-daemon/plugins/power/"
+// Keys of our own, there is no schema for them
+#define SETTINGS_DIR "/org/gnome3-lid/"
+
+#define SETTINGS_SYSTEM_DIR "/etc"
+#define SETTINGS_FILE_NAME "gnome3-lid.conf"
+
+// SETTINGS_POWER_DIR and SETTINGS_DIR, read from each user's database by the system-wide instance
+#define SETTINGS_DUMP_COUNT 2
+
+// Where the system-wide instance keeps the dconf profiles pointing at each user's database
+#define SETTINGS_PROFILE_DIR "/run/gnome3-lid"
+
+// Whether opening the lid wakes the screen up
+#define SETTINGS_LID_OPEN_ACTION_DEFAULT ACTION_WAKE
+
+// Closing the lid on a discharging battery at or below this percentage runs the critical action, 0 never does
+#define SETTINGS_CRITICAL_BATTERY_PERCENT_DEFAULT 5
+#define SETTINGS_LID_CLOSE_CRITICAL_ACTION_DEFAULT ACTION_HIBERNATE
+
+// How long the lid has to stay closed before its action runs
+#define SETTINGS_LID_CLOSE_HOLDOFF_DEFAULT 500
+
+struct Settings;
+
+typedef struct Settings {
+    const struct LidManager* manager;
+
+#ifdef GNOME3_LID_DCONF
+    DConfClient* client;
+    gulong changed_handler;
+
+    // Profile of the active session's user and its settings, system-wide instance only
+    char* profile;
+    uid_t uid;
+    gid_t gid;
+    GKeyFile* user_settings[SETTINGS_DUMP_COUNT];
+    // Dump in progress, user_settings up to dumped are read again
+    GCancellable* dump_cancellable;
+    unsigned dumped;
+    int inotify_fd;
+    guint event_monitor;
+    // ~/.config/dconf of the active session's user
+    int user_watch;
+#else
+    int inotify_fd;
+    guint event_monitor;
+    int system_watch;
+    int user_watch;
+
+    // $XDG_CONFIG_HOME, or the configuration directory of the active session's user
+    char* user_dir;
+#endif
+
+    // Indexed by AC state
+    ActionType lid_close_action[2];
+    // ACTION_WAKE or ACTION_NOTHING
+    ActionType lid_open_action;
+    // Replaces lock and suspend on a critical battery
+    ActionType lid_close_critical_action;
+    guint critical_battery_percent;
+    // Milliseconds
+    guint lid_close_holdoff;
+} Settings;
+
+Settings* settings_new(const struct LidManager* manager);
+void settings_refresh(Settings* settings);
+int settings_set_user(Settings* settings, uid_t uid);
+// Whether changes to the active user's settings are reported, otherwise they have to be refreshed before use
+bool settings_notifies(const Settings* settings);
+void settings_close(Settings* settings);
+
+static inline ActionType settings_lid_close_action(const Settings* settings, bool ac_connected) {
+    return settings->lid_close_action[ac_connected];
+}
+
+static inline ActionType settings_lid_open_action(const Settings* settings) {
+    return settings->lid_open_action;
+}
+
+static inline ActionType settings_lid_close_critical_action(const Settings* settings) {
+    return settings->lid_close_critical_action;
+}
+
+static inline guint settings_critical_battery_percent(const Settings* settings) {
+    return settings->critical_battery_percent;
+}
+
+static inline guint settings_lid_close_holdoff(const Settings* settings) {
+    return settings->lid_close_holdoff;
+}
+
+#endif //SYSTEMD_LID_SETTINGS_H
@@ -0,0 +1,404 @@
+#include <errno.h>
+#include <grp.h>
+#include <malloc.h>
+#include <memory.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "lidManager.h"
+#include "action.h"
+#include "settings.h"
+#include "policy.h"
+#include "eventLoop.h"
+
+#define SETTINGS_USER_DB_NAME "user"
+#define SETTINGS_WATCH_MASK (IN_CLOSE_WRITE|IN_MOVED_TO|IN_CREATE|IN_DELETE)
+
+// Directories dumped from the user's database, indexing Settings.user_settings
+static const char* const settings_dump_dirs[SETTINGS_DUMP_COUNT] = { SETTINGS_POWER_DIR, SETTINGS_DIR };
+
+static GVariant* settings_read(Settings* settings, const char* dir, const char* name) {
+    char key[128];
+
+    if (settings->client) {
+        snprintf(key, sizeof(key), "%s%s", dir, name);
+        return dconf_client_read(settings->client, key);
+    }
+
+    GKeyFile* dump = NULL;
+    for (unsigned i = 0; i < SETTINGS_DUMP_COUNT; i++) {
+        if (strcmp(settings_dump_dirs[i], dir) == 0) {
+            dump = settings->user_settings[i];
+        }
+    }
+    if (!dump) {
+        return NULL;
+    }
+
+    // dconf dump puts the keys of the dumped directory itself in the "/" group
+    char* text = g_key_file_get_value(dump, "/", name, NULL);
+    if (!text) {
+        return NULL;
+    }
+
+    GVariant* value = g_variant_parse(NULL, text, NULL, NULL, NULL);
+    g_free(text);
+
+    return value;
+}
+
+static ActionType settings_read_action(Settings* settings, const char* dir, const char* name, ActionType fallback) {
+    GVariant* value = settings_read(settings, dir, name);
+    if (!value) {
+        return fallback;
+    }
+
+    ActionType action = fallback;
+    if (g_variant_is_of_type(value, G_VARIANT_TYPE_STRING)) {
+        action = action_type_from_string(g_variant_get_string(value, NULL));
+    }
+
+    g_variant_unref(value);
+
+    return action;
+}
+
+static guint settings_read_uint(Settings* settings, const char* dir, const char* name, guint fallback) {
+    GVariant* value = settings_read(settings, dir, name);
+    if (!value) {
+        return fallback;
+    }
+
+    guint result = fallback;
+    if (g_variant_is_of_type(value, G_VARIANT_TYPE_UINT32)) {
+        result = g_variant_get_uint32(value);
+    } else if (g_variant_is_of_type(value, G_VARIANT_TYPE_INT32) && g_variant_get_int32(value) >= 0) {
+        result = (guint) g_variant_get_int32(value);
+    }
+
+    g_variant_unref(value);
+
+    return result;
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+static void settings_changed(DConfClient *client, const gchar *prefix, GStrv changes, const gchar *tag, gpointer user_data) {
+#pragma clang diagnostic pop
+
+    Settings* settings = (Settings*) user_data;
+
+    settings_refresh(settings);
+    if (settings->manager->policy) {
+        policy_compile(settings->manager->policy);
+    }
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+static void settings_dump_child_setup(gpointer user_data) {
+#pragma clang diagnostic pop
+
+    const Settings* settings = (const Settings*) user_data;
+
+    // The database belongs to the user, it is only parsed with the user's rights
+    if (setgroups(0, NULL) < 0 || setgid(settings->gid) < 0 || setuid(settings->uid) < 0) {
+        _exit(1);
+    }
+}
+
+static void settings_dump_next(Settings* settings);
+
+static void settings_dump_reply(GObject* source, GAsyncResult* res, gpointer user_data) {
+    GSubprocess* process = G_SUBPROCESS(source);
+    char* output = NULL;
+    GError* error = NULL;
+
+    if (!g_subprocess_communicate_utf8_finish(process, res, &output, NULL, &error) &&
+        g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        g_error_free(error);
+        return;
+    }
+
+    Settings* settings = (Settings*) user_data;
+    const char* dir = settings_dump_dirs[settings->dumped];
+    GKeyFile* dump = NULL;
+
+    if (error) {
+        fprintf(stderr, "Unable to read %s of %s: %s\n", dir, settings->profile, error->message);
+    } else if (!g_subprocess_get_successful(process)) {
+        fprintf(stderr, "Unable to read %s of %s\n", dir, settings->profile);
+    } else {
+        dump = g_key_file_new();
+        if (!g_key_file_load_from_data(dump, output, (gsize) -1, G_KEY_FILE_NONE, &error)) {
+            fprintf(stderr, "Unable to parse %s of %s: %s\n", dir, settings->profile, error->message);
+            g_key_file_free(dump);
+            dump = NULL;
+        }
+    }
+    g_clear_error(&error);
+    g_free(output);
+
+    if (settings->user_settings[settings->dumped]) {
+        g_key_file_free(settings->user_settings[settings->dumped]);
+    }
+    settings->user_settings[settings->dumped] = dump;
+
+    if (++settings->dumped < SETTINGS_DUMP_COUNT) {
+        settings_dump_next(settings);
+        return;
+    }
+
+    settings_refresh(settings);
+    if (settings->manager->policy) {
+        policy_compile(settings->manager->policy);
+    }
+}
+
+/**
+ * Dump the next directory of the user's database in a dconf child process, without waiting for it. dconf only
+ * takes the profile from the environment, which cannot be changed safely once GDBus and dconf threads run, the
+ * child gets its own instead.
+ *
+ * @param settings
+ */
+static void settings_dump_next(Settings* settings) {
+    GError* error = NULL;
+
+    GSubprocessLauncher* launcher = g_subprocess_launcher_new(G_SUBPROCESS_FLAGS_STDOUT_PIPE |
+                                                              G_SUBPROCESS_FLAGS_STDERR_SILENCE);
+    g_subprocess_launcher_setenv(launcher, "DCONF_PROFILE", settings->profile, TRUE);
+    g_subprocess_launcher_set_child_setup(launcher, settings_dump_child_setup, settings, NULL);
+
+    GSubprocess* process = g_subprocess_launcher_spawn(launcher, &error, "dconf", "dump",
+                                                       settings_dump_dirs[settings->dumped], NULL);
+    g_object_unref(launcher);
+    if (!process) {
+        fprintf(stderr, "Unable to run dconf: %s\n", error->message);
+        g_error_free(error);
+        return;
+    }
+
+    g_subprocess_communicate_utf8_async(process, NULL, settings->dump_cancellable, settings_dump_reply, settings);
+    g_object_unref(process);
+}
+
+/**
+ * Read the settings of the active session's user again, the current ones stay in use until the dump finished.
+ *
+ * @param settings
+ */
+static void settings_load_user(Settings* settings) {
+    if (settings->dump_cancellable) {
+        g_cancellable_cancel(settings->dump_cancellable);
+        g_object_unref(settings->dump_cancellable);
+        settings->dump_cancellable = NULL;
+    }
+    if (!settings->profile) {
+        return;
+    }
+
+    settings->dump_cancellable = g_cancellable_new();
+    settings->dumped = 0;
+    settings_dump_next(settings);
+}
+
+static void settings_clear_user(Settings* settings) {
+    for (unsigned i = 0; i < SETTINGS_DUMP_COUNT; i++) {
+        if (settings->user_settings[i]) {
+            g_key_file_free(settings->user_settings[i]);
+            settings->user_settings[i] = NULL;
+        }
+    }
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+static gboolean settings_handler(gint fd, GIOCondition condition, void *user_data) {
+#pragma clang diagnostic pop
+
+    Settings* settings = (Settings*) user_data;
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+    ssize_t l;
+
+    while ((l = read(settings->inotify_fd, buffer, sizeof(buffer))) > 0) {
+        for (char* p = buffer; p < buffer + l; p += sizeof(struct inotify_event) + ((struct inotify_event*) p)->len) {
+            const struct inotify_event* event = (const struct inotify_event*) p;
+
+            // dconf replaces the database by renaming a new file over it
+            if (event->wd == settings->user_watch &&
+                event->len > 0 && strcmp(event->name, SETTINGS_USER_DB_NAME) == 0) {
+                changed = true;
+            }
+        }
+    }
+
+    if (l < 0 && errno != EAGAIN && errno != EINTR) {
+        settings->event_monitor = 0;
+        return FALSE;
+    }
+
+    if (changed) {
+        settings_load_user(settings);
+    }
+
+    return TRUE;
+}
+
+Settings* settings_new(const struct LidManager* manager) {
+    Settings* settings = malloc(sizeof(Settings));
+    if (!settings) {
+        return NULL;
+    }
+    memset(settings, 0, sizeof(Settings));
+
+    settings->manager = manager;
+    settings->inotify_fd = -1;
+    settings->user_watch = -1;
+
+    if (manager->seat) {
+        settings->inotify_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+        if (settings->inotify_fd >= 0) {
+            settings->event_monitor = eventLoop_add_fd(settings->inotify_fd, settings_handler, settings);
+        }
+
+        // Nothing to read until a user's session is active, see settings_set_user()
+        settings_refresh(settings);
+        return settings;
+    }
+
+    settings->client = dconf_client_new();
+    if (!settings->client) {
+        free(settings);
+        return NULL;
+    }
+
+    settings->changed_handler = g_signal_connect(settings->client, "changed", G_CALLBACK(settings_changed), settings);
+    dconf_client_watch_fast(settings->client, SETTINGS_POWER_DIR);
+    dconf_client_watch_fast(settings->client, SETTINGS_DIR);
+
+    settings_refresh(settings);
+
+    return settings;
+}
+
+static void settings_unwatch(Settings* settings) {
+    if (settings->user_watch >= 0) {
+        inotify_rm_watch(settings->inotify_fd, settings->user_watch);
+        settings->user_watch = -1;
+    }
+}
+
+/**
+ * Read the settings of the user owning the active session, for the system-wide instance. The defaults apply until
+ * the user's database was read, policy_compile() is called once it was. Change notifications are sent on the
+ * user's session bus, the database file is watched instead.
+ *
+ * @param settings
+ * @param uid
+ */
+int settings_set_user(Settings* settings, uid_t uid) {
+    struct passwd pwd, *result = NULL;
+    char buffer[1024];
+
+    settings_unwatch(settings);
+    free(settings->profile);
+    settings->profile = NULL;
+    // Never act on the previous user's settings
+    settings_load_user(settings);
+    settings_clear_user(settings);
+    settings_refresh(settings);
+
+    if (getpwuid_r(uid, &pwd, buffer, sizeof(buffer), &result) != 0 || !result) {
+        return -ENOENT;
+    }
+    settings->uid = pwd.pw_uid;
+    settings->gid = pwd.pw_gid;
+
+    char* profile = g_strdup_printf(SETTINGS_PROFILE_DIR "/dconf-%u", (unsigned) uid);
+    char* contents = g_strdup_printf("file-db:%s/.config/dconf/user\n", pwd.pw_dir);
+
+    mkdir(SETTINGS_PROFILE_DIR, 0755);
+    if (!g_file_set_contents(profile, contents, -1, NULL)) {
+        g_free(profile);
+        g_free(contents);
+        return -EIO;
+    }
+    g_free(contents);
+
+    settings->profile = strdup(profile);
+    g_free(profile);
+
+    if (settings->inotify_fd >= 0) {
+        char* dir = g_strdup_printf("%s/.config/dconf", pwd.pw_dir);
+        settings->user_watch = inotify_add_watch(settings->inotify_fd, dir, SETTINGS_WATCH_MASK);
+        g_free(dir);
+    }
+
+    settings_load_user(settings);
+
+    return 0;
+}
+
+/**
+ * Re-resolve the configured lid close actions and hold-off.
+ *
+ * @param settings
+ */
+void settings_refresh(Settings* settings) {
+    settings->lid_close_action[false] = settings_read_action(settings, SETTINGS_POWER_DIR, "lid-close-battery-action",
+                                                             ACTION_NOTHING);
+    settings->lid_close_action[true] = settings_read_action(settings, SETTINGS_POWER_DIR, "lid-close-ac-action",
+                                                            ACTION_NOTHING);
+    settings->lid_open_action = settings_read_action(settings, SETTINGS_DIR, "lid-open-action",
+                                                     SETTINGS_LID_OPEN_ACTION_DEFAULT);
+    settings->lid_close_critical_action = settings_read_action(settings, SETTINGS_DIR, "lid-close-critical-action",
+                                                               SETTINGS_LID_CLOSE_CRITICAL_ACTION_DEFAULT);
+    settings->critical_battery_percent = settings_read_uint(settings, SETTINGS_DIR, "critical-battery-percent",
+                                                            SETTINGS_CRITICAL_BATTERY_PERCENT_DEFAULT);
+    settings->lid_close_holdoff = settings_read_uint(settings, SETTINGS_DIR, "lid-close-holdoff-ms",
+                                                     SETTINGS_LID_CLOSE_HOLDOFF_DEFAULT);
+}
+
+/**
+ * The user's database is only read again when its file changes, a user that never wrote any setting (no
+ * ~/.config/dconf yet) is read again on the next session change.
+ */
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+bool settings_notifies(const Settings* settings) {
+#pragma clang diagnostic pop
+    return true;
+}
+
+void settings_close(Settings* settings) {
+    if (settings->client && settings->changed_handler) {
+        dconf_client_unwatch_fast(settings->client, SETTINGS_POWER_DIR);
+        dconf_client_unwatch_fast(settings->client, SETTINGS_DIR);
+        g_signal_handler_disconnect(settings->client, settings->changed_handler);
+    }
+    if (settings->client) {
+        g_object_unref(settings->client);
+    }
+
+    if (settings->event_monitor) {
+        eventLoop_remove(settings->event_monitor);
+    }
+    if (settings->inotify_fd >= 0) {
+        close(settings->inotify_fd);
+    }
+    if (settings->dump_cancellable) {
+        g_cancellable_cancel(settings->dump_cancellable);
+        g_object_unref(settings->dump_cancellable);
+    }
+    settings_clear_user(settings);
+
+    free(settings->profile);
+
+    free(settings);
+}
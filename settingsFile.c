@@ -0,0 +1,247 @@
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <malloc.h>
+#include <memory.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/inotify.h>
+
+#include "basic.h"
+#include "lidManager.h"
+#include "action.h"
+#include "settings.h"
+#include "policy.h"
+#include "eventLoop.h"
+
+#define SETTINGS_WATCH_MASK (IN_CLOSE_WRITE|IN_MOVED_TO|IN_MOVED_FROM|IN_CREATE|IN_DELETE)
+
+static char* settings_strip(char* value) {
+    while (isspace((unsigned char) *value)) {
+        value++;
+    }
+
+    char* end = value + strlen(value);
+    while (end > value && isspace((unsigned char) end[-1])) {
+        end--;
+    }
+    *end = 0;
+
+    return value;
+}
+
+static bool settings_parse_uint(const char* value, guint* result) {
+    char* end;
+    errno = 0;
+    const unsigned long parsed = strtoul(value, &end, 10);
+    if (errno != 0 || end == value || *end != 0 || parsed > G_MAXUINT) {
+        return false;
+    }
+
+    *result = (guint) parsed;
+
+    return true;
+}
+
+static void settings_set(Settings* settings, const char* key, const char* value) {
+    if (strcmp(key, "lid-close-battery-action") == 0) {
+        settings->lid_close_action[false] = action_type_from_string(value);
+    } else if (strcmp(key, "lid-close-ac-action") == 0) {
+        settings->lid_close_action[true] = action_type_from_string(value);
+    } else if (strcmp(key, "lid-open-action") == 0) {
+        settings->lid_open_action = action_type_from_string(value);
+    } else if (strcmp(key, "lid-close-critical-action") == 0) {
+        settings->lid_close_critical_action = action_type_from_string(value);
+    } else if (strcmp(key, "critical-battery-percent") == 0) {
+        settings_parse_uint(value, &settings->critical_battery_percent);
+    } else if (strcmp(key, "lid-close-holdoff-ms") == 0) {
+        settings_parse_uint(value, &settings->lid_close_holdoff);
+    }
+}
+
+/**
+ * Apply the "key = value" lines of a file, skipping comments starting with '#' and unknown keys. The keys are
+ * those of the dconf settings.
+ *
+ * @param settings
+ * @param dir Directory holding SETTINGS_FILE_NAME
+ */
+static void settings_parse(Settings* settings, const char* dir) {
+    char path[PATH_MAX];
+    char line[256];
+
+    if (snprintf(path, sizeof(path), "%s/" SETTINGS_FILE_NAME, dir) >= (int) sizeof(path)) {
+        return;
+    }
+
+    FILE* file = fopen(path, "re");
+    if (!file) {
+        return;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        char* key = settings_strip(line);
+        if (*key == '#' || *key == 0) {
+            continue;
+        }
+
+        char* separator = strchr(key, '=');
+        if (!separator) {
+            continue;
+        }
+        *separator = 0;
+
+        settings_set(settings, settings_strip(key), settings_strip(separator + 1));
+    }
+
+    fclose(file);
+}
+
+static int settings_watch(Settings* settings, const char* dir) {
+    if (settings->inotify_fd < 0 || !dir) {
+        return -1;
+    }
+
+    return inotify_add_watch(settings->inotify_fd, dir, SETTINGS_WATCH_MASK);
+}
+
+static void settings_unwatch(Settings* settings, int* watch) {
+    // Watches are shared between paths naming the same directory, keep the one still in use
+    if (*watch >= 0 && *watch != settings->system_watch) {
+        inotify_rm_watch(settings->inotify_fd, *watch);
+    }
+    *watch = -1;
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+static gboolean settings_handler(gint fd, GIOCondition condition, void *user_data) {
+#pragma clang diagnostic pop
+
+    Settings* settings = (Settings*) user_data;
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+    ssize_t l;
+
+    while ((l = read(settings->inotify_fd, buffer, sizeof(buffer))) > 0) {
+        for (char* p = buffer; p < buffer + l; p += sizeof(struct inotify_event) + ((struct inotify_event*) p)->len) {
+            const struct inotify_event* event = (const struct inotify_event*) p;
+
+            if ((event->wd == settings->system_watch || event->wd == settings->user_watch) &&
+                event->len > 0 && strcmp(event->name, SETTINGS_FILE_NAME) == 0) {
+                changed = true;
+            }
+        }
+    }
+
+    if (l < 0 && errno != EAGAIN && errno != EINTR) {
+        settings->event_monitor = 0;
+        return FALSE;
+    }
+
+    if (changed) {
+        settings_refresh(settings);
+        if (settings->manager->policy) {
+            policy_compile(settings->manager->policy);
+        }
+    }
+
+    return TRUE;
+}
+
+Settings* settings_new(const struct LidManager* manager) {
+    Settings* settings = malloc(sizeof(Settings));
+    if (!settings) {
+        return NULL;
+    }
+    memset(settings, 0, sizeof(Settings));
+
+    settings->manager = manager;
+    settings->system_watch = -1;
+    settings->user_watch = -1;
+
+    // Without inotify the files are still read once, they are just not reloaded
+    settings->inotify_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+    if (settings->inotify_fd >= 0) {
+        settings->event_monitor = eventLoop_add_fd(settings->inotify_fd, settings_handler, settings);
+    }
+
+    settings->system_watch = settings_watch(settings, SETTINGS_SYSTEM_DIR);
+
+    if (!manager->seat) {
+        // Nothing to read for the system-wide instance until a user's session is active, see settings_set_user()
+        settings->user_dir = g_strdup(g_get_user_config_dir());
+        settings->user_watch = settings_watch(settings, settings->user_dir);
+    }
+
+    settings_refresh(settings);
+
+    return settings;
+}
+
+/**
+ * Read the file of the user owning the active session, for the system-wide instance.
+ *
+ * @param settings
+ * @param uid
+ */
+int settings_set_user(Settings* settings, uid_t uid) {
+    struct passwd pwd, *result = NULL;
+    char buffer[1024];
+
+    settings_unwatch(settings, &settings->user_watch);
+    g_free(settings->user_dir);
+    settings->user_dir = NULL;
+
+    if (getpwuid_r(uid, &pwd, buffer, sizeof(buffer), &result) != 0 || !result) {
+        settings_refresh(settings);
+        return -ENOENT;
+    }
+
+    settings->user_dir = g_strdup_printf("%s/.config", pwd.pw_dir);
+    settings->user_watch = settings_watch(settings, settings->user_dir);
+
+    settings_refresh(settings);
+
+    return 0;
+}
+
+/**
+ * Re-read the files, the system file first so the user's file overrides it key by key.
+ *
+ * @param settings
+ */
+void settings_refresh(Settings* settings) {
+    settings->lid_close_action[false] = ACTION_NOTHING;
+    settings->lid_close_action[true] = ACTION_NOTHING;
+    settings->lid_open_action = SETTINGS_LID_OPEN_ACTION_DEFAULT;
+    settings->lid_close_critical_action = SETTINGS_LID_CLOSE_CRITICAL_ACTION_DEFAULT;
+    settings->critical_battery_percent = SETTINGS_CRITICAL_BATTERY_PERCENT_DEFAULT;
+    settings->lid_close_holdoff = SETTINGS_LID_CLOSE_HOLDOFF_DEFAULT;
+
+    settings_parse(settings, SETTINGS_SYSTEM_DIR);
+    if (settings->user_dir) {
+        settings_parse(settings, settings->user_dir);
+    }
+}
+
+/**
+ * A directory that could not be watched, e.g. a user without ~/.config, is re-read before every use instead.
+ */
+bool settings_notifies(const Settings* settings) {
+    return settings->system_watch >= 0 && (!settings->user_dir || settings->user_watch >= 0);
+}
+
+void settings_close(Settings* settings) {
+    if (settings->event_monitor) {
+        eventLoop_remove(settings->event_monitor);
+    }
+    if (settings->inotify_fd >= 0) {
+        close(settings->inotify_fd);
+    }
+
+    g_free(settings->user_dir);
+
+    free(settings);
+}
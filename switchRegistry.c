@@ -0,0 +1,181 @@
+#include <malloc.h>
+#include <memory.h>
+
+#include "lidManager.h"
+#include "button.h"
+#include "switchRegistry.h"
+#include "udevMonitor.h"
+#include "eventLoop.h"
+#include "latency.h"
+#include "recorder.h"
+
+static void switchRegistry_count(SwitchRegistry* registry, bool lid_closed, bool docked, int delta) {
+    if (lid_closed) {
+        registry->lid_closed_count += delta;
+    }
+    if (docked) {
+        registry->docked_count += delta;
+    }
+
+    registry->state =
+            ((registry->lid_closed_count > 0)? SWITCH_LID_CLOSED : 0) |
+            ((registry->docked_count > 0)? SWITCH_DOCKED : 0);
+}
+
+static Button* switchRegistry_find(SwitchRegistry* registry, const char* name) {
+    return (Button*) g_hash_table_lookup(registry->buttons, name);
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+static gboolean switch_device_handler(gint fd, GIOCondition condition, void *user_data) {
+#pragma clang diagnostic pop
+
+    SwitchRegistry* registry = (SwitchRegistry*) user_data;
+
+    struct udev_device* device = udev_monitor_receive_device(registry->udev_monitor);
+    if (!device) {
+        return TRUE;
+    }
+
+    const char* action = udev_device_get_action(device);
+    const char* name = udev_device_get_sysname(device);
+    const unsigned state = registry->state;
+
+    if (action && name) {
+        Button* button = switchRegistry_find(registry, name);
+
+        if (strcmp(action, "remove") == 0) {
+            if (button) {
+                switchRegistry_remove(registry, button);
+                button_close(button);
+            }
+        } else if (lidManager_on_seat(registry->manager, device)) {
+            switchRegistry_open_device(registry, name);
+        }
+    }
+
+    udev_device_unref(device);
+
+    if (registry->state != state) {
+        const gint64 now = latency_now();
+        latency_origin(now, now);
+        registry->manager->handler(registry->manager);
+    }
+
+    return TRUE;
+}
+
+SwitchRegistry* switchRegistry_new(const struct LidManager* manager) {
+    SwitchRegistry* registry = malloc(sizeof(SwitchRegistry));
+    if (!registry) {
+        return NULL;
+    }
+    memset(registry, 0, sizeof(SwitchRegistry));
+
+    registry->manager = manager;
+    // Keyed by the name each button owns, which lives exactly as long as its entry
+    registry->buttons = g_hash_table_new(g_str_hash, g_str_equal);
+    registry->lid_closed_count = 0;
+    registry->docked_count = 0;
+    registry->state = 0;
+
+    return registry;
+}
+
+/**
+ * Follow power-switch input devices as they are added and removed.
+ *
+ * @param registry
+ */
+int switchRegistry_monitor(SwitchRegistry* registry) {
+    struct udev_monitor* udev_monitor = NULL;
+
+    int fd_udev = udevMonitor_open(registry->manager->udev, "input", "power-switch", &udev_monitor);
+    if (fd_udev < 0) {
+        return fd_udev;
+    }
+
+    registry->udev_monitor = udev_monitor;
+    registry->event_monitor = eventLoop_add_fd(fd_udev, switch_device_handler, registry);
+
+    return 0;
+}
+
+int switchRegistry_open_device(SwitchRegistry* registry, const char* name) {
+    Button* button = switchRegistry_find(registry, name);
+    if (button) {
+        return 0;
+    }
+
+    int r = button_create(registry->manager, &button, name, registry->manager->handler);
+    if (r < 0) {
+        return r;
+    }
+
+    switchRegistry_add(registry, button);
+
+    return 0;
+}
+
+void switchRegistry_add(SwitchRegistry* registry, Button* button) {
+    recorder_record(latency_now(), RECORDER_SWITCH_DEVICE, 1, button->fd);
+    g_hash_table_insert(registry->buttons, button->name, button);
+    switchRegistry_count(registry, button->lid_closed, button->docked, 1);
+}
+
+void switchRegistry_remove(SwitchRegistry* registry, Button* button) {
+    if (g_hash_table_remove(registry->buttons, button->name)) {
+        recorder_record(latency_now(), RECORDER_SWITCH_DEVICE, 0, button->fd);
+        switchRegistry_count(registry, button->lid_closed, button->docked, -1);
+    }
+}
+
+/**
+ * Fold a state change of one device into the aggregate state.
+ *
+ * @param registry
+ * @param button Device with its new state applied
+ * @param was_lid_closed Lid state of the device before the change
+ * @param was_docked Dock state of the device before the change
+ */
+void switchRegistry_update(SwitchRegistry* registry, const Button* button, bool was_lid_closed, bool was_docked) {
+    switchRegistry_count(registry, was_lid_closed, was_docked, -1);
+    switchRegistry_count(registry, button->lid_closed, button->docked, 1);
+}
+
+/**
+ * Re-read every device, without running the handler.
+ *
+ * @param registry
+ */
+void switchRegistry_snapshot(SwitchRegistry* registry) {
+    GHashTableIter iter;
+    gpointer button;
+
+    g_hash_table_iter_init(&iter, registry->buttons);
+    while (g_hash_table_iter_next(&iter, NULL, &button)) {
+        button_snapshot((Button*) button);
+    }
+}
+
+void switchRegistry_close(SwitchRegistry* registry) {
+    GHashTableIter iter;
+    gpointer button;
+
+    if (registry->event_monitor) {
+        eventLoop_remove(registry->event_monitor);
+    }
+    if (registry->udev_monitor) {
+        udev_monitor_unref(registry->udev_monitor);
+    }
+
+    g_hash_table_iter_init(&iter, registry->buttons);
+    while (g_hash_table_iter_next(&iter, NULL, &button)) {
+        g_hash_table_iter_steal(&iter);
+        button_close((Button*) button);
+    }
+
+    g_hash_table_unref(registry->buttons);
+    free(registry);
+}
@@ -0,0 +1,48 @@
+#ifndef SYSTEMD_LID_SWITCH_REGISTRY_H
+#define SYSTEMD_LID_SWITCH_REGISTRY_H
+
+#include <stdbool.h>
+#include <gio/gio.h>
+
+#include "lidManager.h"
+
+struct Button;
+struct SwitchRegistry;
+
+typedef enum SwitchState {
+    SWITCH_LID_CLOSED = 1 << 0,
+    SWITCH_DOCKED = 1 << 1,
+} SwitchState;
+
+typedef struct SwitchRegistry {
+    const struct LidManager* manager;
+
+    struct udev_monitor* udev_monitor;
+    guint event_monitor;
+
+    // sysname (e.g. event3) -> Button
+    GHashTable* buttons;
+
+    unsigned lid_closed_count;
+    unsigned docked_count;
+    unsigned state;
+} SwitchRegistry;
+
+SwitchRegistry* switchRegistry_new(const struct LidManager* manager);
+int switchRegistry_monitor(SwitchRegistry* registry);
+int switchRegistry_open_device(SwitchRegistry* registry, const char* name);
+void switchRegistry_add(SwitchRegistry* registry, struct Button* button);
+void switchRegistry_remove(SwitchRegistry* registry, struct Button* button);
+void switchRegistry_update(SwitchRegistry* registry, const struct Button* button, bool was_lid_closed, bool was_docked);
+void switchRegistry_snapshot(SwitchRegistry* registry);
+void switchRegistry_close(SwitchRegistry* registry);
+
+static inline unsigned switchRegistry_state(const SwitchRegistry* registry) {
+    return registry->state;
+}
+
+static inline guint switchRegistry_size(const SwitchRegistry* registry) {
+    return g_hash_table_size(registry->buttons);
+}
+
+#endif //SYSTEMD_LID_SWITCH_REGISTRY_H
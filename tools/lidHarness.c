@@ -0,0 +1,433 @@
+/*
+ * Benchmark and soak harness for the lid and AC paths.
+ *
+ * A virtual SW_LID/SW_DOCK device is created through /dev/uinput and the daemon is pointed at a fake
+ * power_supply tree. Lid transitions go through the kernel and button_handler, AC transitions are fed to
+ * power_supply_changed, the part of ac_adapter_handler past the netlink read, since a fake sysfs tree cannot
+ * emit uevents. Both end in policy_evaluate. No logind connection is made, so decisions stay queued.
+ *
+ * Usage: gnome3-lid-harness [transitions]
+ *
+ * Needs write access to /dev/uinput.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <memory.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "basic.h"
+#include "lidManager.h"
+#include "switchRegistry.h"
+#include "power.h"
+#include "eventLoop.h"
+#include "latency.h"
+#include "policy.h"
+
+#define HARNESS_TRANSITIONS 10000
+#define HARNESS_SUPPLY "AC"
+// Seconds without progress before the run is abandoned
+#define HARNESS_TIMEOUT 5
+
+typedef enum HarnessPhase {
+    HARNESS_LID = 0,
+    HARNESS_AC,
+    HARNESS_PHASE_COUNT,
+} HarnessPhase;
+
+static const char* harness_phase_names[HARNESS_PHASE_COUNT] = {
+        [HARNESS_LID] = "lid",
+        [HARNESS_AC] = "ac",
+};
+
+typedef struct HarnessIo {
+    guint64 syscr;
+    guint64 syscw;
+    gint64 cpu;
+} HarnessIo;
+
+static struct {
+    LidManager* manager;
+    int uinput;
+    char root[64];
+
+    bool running;
+    HarnessPhase phase;
+    unsigned transitions;
+    unsigned done;
+    bool failed;
+
+    gint64 sent;
+    gint64* samples[HARNESS_PHASE_COUNT];
+    HarnessIo start[HARNESS_PHASE_COUNT];
+    HarnessIo end[HARNESS_PHASE_COUNT];
+
+    unsigned progress;
+    unsigned watched;
+} harness;
+
+static void harness_snapshot(HarnessIo* io) {
+    memset(io, 0, sizeof(HarnessIo));
+
+    FILE* file = fopen("/proc/self/io", "re");
+    if (file) {
+        char key[32];
+        unsigned long long value;
+        while (fscanf(file, "%31[^:]: %llu\n", key, &value) == 2) {
+            if (strcmp(key, "syscr") == 0) {
+                io->syscr = value;
+            } else if (strcmp(key, "syscw") == 0) {
+                io->syscw = value;
+            }
+        }
+        fclose(file);
+    }
+
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        io->cpu = latency_timeval(usage.ru_utime.tv_sec, usage.ru_utime.tv_usec) +
+                  latency_timeval(usage.ru_stime.tv_sec, usage.ru_stime.tv_usec);
+    }
+}
+
+static int harness_emit(int fd, unsigned short type, unsigned short code, int value) {
+    struct input_event ev;
+    memset(&ev, 0, sizeof(ev));
+
+    ev.type = type;
+    ev.code = code;
+    ev.value = value;
+
+    return (write(fd, &ev, sizeof(ev)) == sizeof(ev))? 0 : -errno;
+}
+
+/**
+ * Start the next transition of the current phase, the policy handler completes it.
+ */
+static void harness_step(void) {
+    // Even transitions close the lid or unplug AC, odd ones undo it
+    const int value = (harness.done % 2 == 0);
+
+    harness.sent = latency_now();
+
+    if (harness.phase == HARNESS_LID) {
+        if (harness_emit(harness.uinput, EV_SW, SW_LID, value) < 0 ||
+            harness_emit(harness.uinput, EV_SYN, SYN_REPORT, 0) < 0) {
+            fprintf(stderr, "Unable to write to uinput: %m\n");
+            harness.failed = true;
+            eventLoop_quit();
+        }
+    } else {
+        const PowerSupplyUevent uevent = {
+                .action = "change",
+                .name = HARNESS_SUPPLY,
+                .type = "Mains",
+                .online = value? "0" : "1",
+        };
+        power_supply_changed(harness.manager->power, &uevent);
+    }
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+static gboolean harness_next(void* user_data) {
+#pragma clang diagnostic pop
+
+    harness_step();
+
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Run the next transition from the loop rather than from inside the handler. AC transitions call back into the
+ * handler synchronously, so stepping inline would nest one frame per transition.
+ */
+static void harness_schedule(void) {
+    eventLoop_add_timeout(0, harness_next, NULL);
+}
+
+static void harness_handler(const LidManager* lidManager) {
+    policy_evaluate(lidManager);
+
+    // Includes the decision itself, which is what the harness measures
+    const gint64 decided = latency_now();
+
+    if (!harness.running || harness.failed || harness.phase >= HARNESS_PHASE_COUNT) {
+        return;
+    }
+
+    harness.samples[harness.phase][harness.done] = decided - harness.sent;
+    harness.progress++;
+
+    if (++harness.done < harness.transitions) {
+        harness_schedule();
+        return;
+    }
+
+    harness_snapshot(&harness.end[harness.phase]);
+    harness.done = 0;
+    harness.phase++;
+
+    if (harness.phase == HARNESS_PHASE_COUNT) {
+        eventLoop_quit();
+        return;
+    }
+
+    harness_snapshot(&harness.start[harness.phase]);
+    harness_schedule();
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+static gboolean harness_watchdog(gpointer user_data) {
+#pragma clang diagnostic pop
+
+    if (harness.progress == harness.watched) {
+        fprintf(stderr, "No %s transition handled for %d s\n", harness_phase_names[harness.phase], HARNESS_TIMEOUT);
+        harness.failed = true;
+        eventLoop_quit();
+        return G_SOURCE_REMOVE;
+    }
+
+    harness.watched = harness.progress;
+
+    return G_SOURCE_CONTINUE;
+}
+
+static int harness_compare(const void* a, const void* b) {
+    const gint64 x = *(const gint64*) a;
+    const gint64 y = *(const gint64*) b;
+
+    return (x > y) - (x < y);
+}
+
+static void harness_report(HarnessPhase phase) {
+    gint64* samples = harness.samples[phase];
+    const unsigned n = harness.transitions;
+    const HarnessIo* start = &harness.start[phase];
+    const HarnessIo* end = &harness.end[phase];
+
+    qsort(samples, n, sizeof(gint64), harness_compare);
+
+    printf("%-4s %u transitions, event to decision p50 %.1f us p90 %.1f us p99 %.1f us max %.1f us, "
+           "%.2f read + %.2f write syscalls per event, %.2f us CPU per event\n",
+           harness_phase_names[phase], n,
+           samples[n / 2] / 1000.0,
+           samples[n * 9 / 10] / 1000.0,
+           samples[n * 99 / 100] / 1000.0,
+           samples[n - 1] / 1000.0,
+           (double) (end->syscr - start->syscr) / n,
+           (double) (end->syscw - start->syscw) / n,
+           (end->cpu - start->cpu) / 1000.0 / n);
+}
+
+/**
+ * Create the virtual switch device.
+ *
+ * @param sysname Receives the input device name, e.g. input17
+ * @return The uinput fd or a negative error
+ */
+static int harness_uinput_open(char* sysname, size_t size) {
+    int fd = open("/dev/uinput", O_WRONLY|O_NONBLOCK|O_CLOEXEC);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    struct uinput_setup setup;
+    memset(&setup, 0, sizeof(setup));
+    setup.id.bustype = BUS_VIRTUAL;
+    strncpy(setup.name, "gnome3-lid harness switch", UINPUT_MAX_NAME_SIZE - 1);
+
+    if (ioctl(fd, UI_SET_EVBIT, EV_SW) < 0 ||
+        ioctl(fd, UI_SET_SWBIT, SW_LID) < 0 ||
+        ioctl(fd, UI_SET_SWBIT, SW_DOCK) < 0 ||
+        ioctl(fd, UI_DEV_SETUP, &setup) < 0 ||
+        ioctl(fd, UI_DEV_CREATE) < 0 ||
+        ioctl(fd, UI_GET_SYSNAME(size), sysname) < 0) {
+        int r = -errno;
+        close(fd);
+        return r;
+    }
+
+    return fd;
+}
+
+/**
+ * Find the eventN node of an input device, which shows up asynchronously after UI_DEV_CREATE.
+ */
+static int harness_find_event(const char* sysname, char* name, size_t size) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/class/input/%s", sysname);
+
+    for (unsigned attempt = 0; attempt < 100; attempt++) {
+        _cleanup_(closedirp) DIR* d = opendir(path);
+        struct dirent* de;
+
+        if (d) {
+            while ((de = readdir(d))) {
+                if (strncmp(de->d_name, "event", 5) == 0) {
+                    snprintf(name, size, "%s", de->d_name);
+                    // Leave udev time to set the device node permissions
+                    usleep(100 * 1000);
+                    return 0;
+                }
+            }
+        }
+
+        usleep(10 * 1000);
+    }
+
+    return -ENOENT;
+}
+
+static int harness_write_file(const char* dir, const char* name, const char* contents) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    FILE* file = fopen(path, "we");
+    if (!file) {
+        return -errno;
+    }
+    fputs(contents, file);
+    fclose(file);
+
+    return 0;
+}
+
+/**
+ * Build <root>/class/power_supply/AC with the supply online.
+ */
+static int harness_sysfs_create(void) {
+    char dir[256];
+
+    snprintf(harness.root, sizeof(harness.root), "/tmp/gnome3-lid-harness.XXXXXX");
+    if (!mkdtemp(harness.root)) {
+        return -errno;
+    }
+
+    snprintf(dir, sizeof(dir), "%s/class", harness.root);
+    mkdir(dir, 0755);
+    snprintf(dir, sizeof(dir), "%s/class/power_supply", harness.root);
+    mkdir(dir, 0755);
+    snprintf(dir, sizeof(dir), "%s/class/power_supply/%s", harness.root, HARNESS_SUPPLY);
+    if (mkdir(dir, 0755) < 0) {
+        return -errno;
+    }
+
+    if (harness_write_file(dir, "type", "Mains\n") < 0 || harness_write_file(dir, "online", "1\n") < 0) {
+        return -EIO;
+    }
+
+    return 0;
+}
+
+static void harness_sysfs_remove(void) {
+    char path[256];
+
+    snprintf(path, sizeof(path), "%s/class/power_supply/%s/type", harness.root, HARNESS_SUPPLY);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/class/power_supply/%s/online", harness.root, HARNESS_SUPPLY);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/class/power_supply/%s", harness.root, HARNESS_SUPPLY);
+    rmdir(path);
+    snprintf(path, sizeof(path), "%s/class/power_supply", harness.root);
+    rmdir(path);
+    snprintf(path, sizeof(path), "%s/class", harness.root);
+    rmdir(path);
+    rmdir(harness.root);
+}
+
+int main(int argc, char** argv) {
+    char sysname[64];
+    char event[32];
+    int r = 1;
+
+    harness.transitions = (argc > 1)? (unsigned) strtoul(argv[1], NULL, 10) : HARNESS_TRANSITIONS;
+    if (harness.transitions < 2) {
+        fprintf(stderr, "Usage: %s [transitions]\n", argv[0]);
+        return 1;
+    }
+    // Every phase ends with the lid open and AC connected
+    harness.transitions += harness.transitions % 2;
+
+    harness.uinput = -1;
+
+    if (harness_sysfs_create() < 0) {
+        fprintf(stderr, "Unable to create the fake power_supply tree: %m\n");
+        return 1;
+    }
+    setenv("GNOME3_LID_SYSFS_ROOT", harness.root, 1);
+
+    harness.uinput = harness_uinput_open(sysname, sizeof(sysname));
+    if (harness.uinput < 0) {
+        fprintf(stderr, "Unable to create the uinput device: %s\n", strerror(-harness.uinput));
+        goto exit;
+    }
+
+    if (harness_find_event(sysname, event, sizeof(event)) < 0) {
+        fprintf(stderr, "No event node for %s\n", sysname);
+        goto exit;
+    }
+
+    for (unsigned phase = 0; phase < HARNESS_PHASE_COUNT; phase++) {
+        harness.samples[phase] = calloc(harness.transitions, sizeof(gint64));
+        if (!harness.samples[phase]) {
+            goto exit;
+        }
+    }
+
+    if (lidManager_new(&harness.manager, harness_handler, NULL) < 0) {
+        goto exit;
+    }
+
+    if (switchRegistry_open_device(harness.manager->switches, event) < 0) {
+        fprintf(stderr, "Unable to open %s%s\n", harness.manager->input_dir, event);
+        goto exit;
+    }
+
+    if (power_create(harness.manager, &harness.manager->power, harness.manager->handler) < 0) {
+        fprintf(stderr, "Unable to scan %s\n", harness.manager->power_supply_dir);
+        goto exit;
+    }
+
+    eventLoop_add_timeout(HARNESS_TIMEOUT * 1000, harness_watchdog, NULL);
+
+    harness.phase = HARNESS_LID;
+    harness.running = true;
+    harness_snapshot(&harness.start[HARNESS_LID]);
+    harness_step();
+
+    eventLoop_run();
+
+    if (!harness.failed) {
+        for (unsigned phase = 0; phase < HARNESS_PHASE_COUNT; phase++) {
+            harness_report(phase);
+        }
+        printf("Lid close actions suppressed by the hold-off: %u\n", harness.manager->policy->suppressed);
+        latency_dump(stdout);
+        r = 0;
+    }
+
+    exit:
+    if (harness.manager) {
+        lidManager_close(harness.manager);
+    }
+    if (harness.uinput >= 0) {
+        ioctl(harness.uinput, UI_DEV_DESTROY);
+        close(harness.uinput);
+    }
+    for (unsigned phase = 0; phase < HARNESS_PHASE_COUNT; phase++) {
+        free(harness.samples[phase]);
+    }
+    harness_sysfs_remove();
+
+    return r;
+}
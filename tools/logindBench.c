@@ -0,0 +1,206 @@
+/*
+ * Per-call cost of the logind backend the build was configured with (GDBus, or sd-bus with GNOME3_LID_SDBUS).
+ *
+ * Issues Session.Lock calls one after the other against the mock logind and reports the call latency, the
+ * allocations per call, the heap growth, RSS and thread count. Only runs on a private bus, a real logind would
+ * lock the session.
+ *
+ * Allocations are counted by the malloc family defined below, which takes precedence over glibc's for the whole
+ * process, libraries and the GDBus worker thread included. GSlice is switched to plain malloc so its allocations
+ * are counted too.
+ *
+ * Usage: GNOME3_LID_BUS_ADDRESS=... gnome3-lid-logind-bench [calls]
+ */
+#include <malloc.h>
+#include <memory.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <gio/gio.h>
+
+#include "logind.h"
+#include "eventLoop.h"
+#include "latency.h"
+
+#define BENCH_CALLS 10000
+#define BENCH_WARMUP 100
+#define BENCH_SESSION_PATH "/org/freedesktop/login1/session/mock"
+
+typedef struct BenchUsage {
+    uint64_t allocations;
+    size_t heap;
+    long rss;
+    long threads;
+} BenchUsage;
+
+static struct {
+    Logind* logind;
+
+    unsigned calls;
+    unsigned done;
+    unsigned failed;
+
+    gint64 sent;
+    gint64* samples;
+
+    BenchUsage start;
+} bench;
+
+static uint64_t bench_allocations;
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size) {
+    __atomic_fetch_add(&bench_allocations, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    __atomic_fetch_add(&bench_allocations, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    __atomic_fetch_add(&bench_allocations, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+static long bench_status_field(const char* field) {
+    FILE* file = fopen("/proc/self/status", "re");
+    if (!file) {
+        return -1;
+    }
+
+    char line[256];
+    long value = -1;
+    const size_t length = strlen(field);
+    while (fgets(line, sizeof(line), file)) {
+        if (strncmp(line, field, length) == 0 && line[length] == ':') {
+            value = strtol(line + length + 1, NULL, 10);
+            break;
+        }
+    }
+    fclose(file);
+
+    return value;
+}
+
+static void bench_usage(BenchUsage* usage) {
+    // mallinfo2() needs glibc 2.33, older ones only have the int sized mallinfo()
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+    usage->heap = info.uordblks;
+#else
+    struct mallinfo info = mallinfo();
+    usage->heap = (size_t) (unsigned int) info.uordblks;
+#endif
+    usage->allocations = __atomic_load_n(&bench_allocations, __ATOMIC_RELAXED);
+    usage->rss = bench_status_field("VmRSS");
+    usage->threads = bench_status_field("Threads");
+}
+
+static void bench_call(void);
+
+static void bench_reply(int error, void* user_data) {
+    const gint64 now = latency_now();
+    (void) user_data;
+
+    if (error < 0) {
+        bench.failed++;
+    }
+
+    if (bench.done >= BENCH_WARMUP) {
+        bench.samples[bench.done - BENCH_WARMUP] = now - bench.sent;
+    }
+    if (bench.done + 1 == BENCH_WARMUP) {
+        bench_usage(&bench.start);
+    }
+
+    if (++bench.done == bench.calls + BENCH_WARMUP) {
+        eventLoop_quit();
+        return;
+    }
+
+    bench_call();
+}
+
+static void bench_call(void) {
+    bench.sent = latency_now();
+    logind_call(bench.logind, LOGIND_LOCK_SESSION, BENCH_SESSION_PATH, NULL, bench_reply, NULL);
+}
+
+static int bench_compare(const void* a, const void* b) {
+    const gint64 x = *(const gint64*) a;
+    const gint64 y = *(const gint64*) b;
+
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char** argv) {
+    GError* error = NULL;
+    const char* address = getenv("GNOME3_LID_BUS_ADDRESS");
+
+    if (!address) {
+        fprintf(stderr, "Set GNOME3_LID_BUS_ADDRESS to a bus running gnome3-lid-mock-logind\n");
+        return 1;
+    }
+
+    // Before GLib is used, so GSlice picks it up
+    setenv("G_SLICE", "always-malloc", 1);
+
+    bench.calls = (argc > 1)? (unsigned) strtoul(argv[1], NULL, 10) : BENCH_CALLS;
+    if (bench.calls == 0) {
+        fprintf(stderr, "Usage: %s [calls]\n", argv[0]);
+        return 1;
+    }
+
+    bench.samples = calloc(bench.calls, sizeof(gint64));
+    if (!bench.samples) {
+        return 1;
+    }
+
+    GDBusConnection* connection = g_dbus_connection_new_for_address_sync(
+            address,
+            G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT | G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+            NULL,
+            NULL,
+            &error);
+    if (!connection) {
+        fprintf(stderr, "Unable to connect to %s: %s\n", address, error->message);
+        g_error_free(error);
+        return 1;
+    }
+
+    bench.logind = logind_new();
+    if (!bench.logind || logind_attach(bench.logind, connection) < 0) {
+        return 1;
+    }
+
+    bench_call();
+    eventLoop_run();
+
+    BenchUsage end;
+    bench_usage(&end);
+
+    const unsigned n = bench.calls;
+    qsort(bench.samples, n, sizeof(gint64), bench_compare);
+
+    printf("%u calls (%u failed), latency p50 %.1f us p90 %.1f us p99 %.1f us max %.1f us\n",
+           n, bench.failed,
+           bench.samples[n / 2] / 1000.0,
+           bench.samples[n * 9 / 10] / 1000.0,
+           bench.samples[n * 99 / 100] / 1000.0,
+           bench.samples[n - 1] / 1000.0);
+    printf("%.1f allocations per call (malloc, calloc and realloc)\n",
+           (double) (end.allocations - bench.start.allocations) / n);
+    printf("heap in use %+ld bytes after warm-up, RSS %ld kB (%+ld kB), %ld threads\n",
+           (long) (end.heap - bench.start.heap), end.rss, end.rss - bench.start.rss, end.threads);
+
+    logind_close(bench.logind);
+    g_object_unref(connection);
+    free(bench.samples);
+
+    return 0;
+}
@@ -0,0 +1,496 @@
+/*
+ * Minimal logind for exercising the action paths without locking or suspending the machine.
+ *
+ * Owns org.freedesktop.login1 on the session bus, or on the bus at $GNOME3_LID_BUS_ADDRESS, and answers
+ * ListSessions, GetSession, GetSessionByPID, GetSeat, LockSession, Session.Lock, Suspend, Hibernate,
+ * SuspendThenHibernate, PowerOff, the matching Can* methods and Inhibit for a single session on seat0. The
+ * Manager's BlockInhibited, the Seat's ActiveSession and the Session's User properties are exported as well.
+ * Every call is logged to stdout with its arrival time.
+ *
+ * Usage: gnome3-lid-mock-logind [--delay METHOD=MS]... [--fail METHOD=ERROR]... [--can METHOD=ANSWER]...
+ *
+ * METHOD is a method name or * for all of them. ANSWER is yes, no, challenge or na, yes by default. Behaviour
+ * can also be changed at runtime on /org/gnome3lid/MockLogind through org.gnome3lid.MockLogind.Configure(method,
+ * delay_ms, error), an empty error clears it, and SetCan(method, answer), which also emits PropertiesChanged for
+ * the Manager's BlockInhibited like logind does when inhibitors change. See tools/mockLogind.sh to run the daemon
+ * against it on a private bus.
+ */
+#include <malloc.h>
+#include <memory.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <gio/gio.h>
+#include <gio/gunixfdlist.h>
+#include <glib-unix.h>
+
+#include "action.h"
+#include "session.h"
+
+#define MOCK_SESSION_ID "mock"
+#define MOCK_SESSION_PATH "/org/freedesktop/login1/session/mock"
+#define MOCK_SEAT_ID "seat0"
+#define MOCK_SEAT_PATH "/org/freedesktop/login1/seat/seat0"
+#define MOCK_USER_PATH "/org/freedesktop/login1/user/self"
+#define MOCK_CONTROL_PATH "/org/gnome3lid/MockLogind"
+
+static const char introspection_xml[] =
+        "<node>"
+        "  <interface name='" LOGIND_MANAGER_INTERFACE "'>"
+        "    <method name='ListSessions'><arg type='a(susso)' direction='out'/></method>"
+        "    <method name='GetSession'><arg type='s' direction='in'/><arg type='o' direction='out'/></method>"
+        "    <method name='GetSessionByPID'><arg type='u' direction='in'/><arg type='o' direction='out'/></method>"
+        "    <method name='LockSession'><arg type='s' direction='in'/></method>"
+        "    <method name='Suspend'><arg type='b' direction='in'/></method>"
+        "    <method name='Hibernate'><arg type='b' direction='in'/></method>"
+        "    <method name='SuspendThenHibernate'><arg type='b' direction='in'/></method>"
+        "    <method name='PowerOff'><arg type='b' direction='in'/></method>"
+        "    <method name='GetSeat'><arg type='s' direction='in'/><arg type='o' direction='out'/></method>"
+        "    <method name='CanSuspend'><arg type='s' direction='out'/></method>"
+        "    <method name='CanHibernate'><arg type='s' direction='out'/></method>"
+        "    <method name='CanPowerOff'><arg type='s' direction='out'/></method>"
+        "    <method name='CanSuspendThenHibernate'><arg type='s' direction='out'/></method>"
+        "    <property name='BlockInhibited' type='s' access='read'/>"
+        "    <method name='Inhibit'>"
+        "      <arg type='s' direction='in'/><arg type='s' direction='in'/>"
+        "      <arg type='s' direction='in'/><arg type='s' direction='in'/>"
+        "      <arg type='h' direction='out'/>"
+        "    </method>"
+        "    <signal name='SessionNew'><arg type='s'/><arg type='o'/></signal>"
+        "    <signal name='SessionRemoved'><arg type='s'/><arg type='o'/></signal>"
+        "    <signal name='PrepareForSleep'><arg type='b'/></signal>"
+        "    <signal name='PrepareForShutdown'><arg type='b'/></signal>"
+        "  </interface>"
+        "  <interface name='" LOGIND_SESSION_INTERFACE "'>"
+        "    <method name='Lock'/>"
+        "    <signal name='Lock'/>"
+        "    <property name='User' type='(uo)' access='read'/>"
+        "  </interface>"
+        "  <interface name='org.gnome3lid.MockLogind'>"
+        "    <method name='Configure'>"
+        "      <arg type='s' name='method' direction='in'/>"
+        "      <arg type='u' name='delay_ms' direction='in'/>"
+        "      <arg type='s' name='error' direction='in'/>"
+        "    </method>"
+        "    <method name='SetCan'>"
+        "      <arg type='s' name='method' direction='in'/>"
+        "      <arg type='s' name='answer' direction='in'/>"
+        "    </method>"
+        "  </interface>"
+        "  <interface name='" LOGIND_SEAT_INTERFACE "'>"
+        "    <property name='ActiveSession' type='(so)' access='read'/>"
+        "  </interface>"
+        "</node>";
+
+typedef struct MockMethod {
+    const char* name;
+    guint delay;
+    char* error;
+    // Answer of the Can* methods, NULL for the others
+    const char* answer;
+    unsigned calls;
+} MockMethod;
+
+static MockMethod methods[] = {
+        { .name = "ListSessions" },
+        { .name = "GetSession" },
+        { .name = "GetSessionByPID" },
+        { .name = "LockSession" },
+        { .name = "Lock" },
+        { .name = "Suspend" },
+        { .name = "Hibernate" },
+        { .name = "SuspendThenHibernate" },
+        { .name = "PowerOff" },
+        { .name = "GetSeat" },
+        { .name = "CanSuspend", .answer = "yes" },
+        { .name = "CanHibernate", .answer = "yes" },
+        { .name = "CanPowerOff", .answer = "yes" },
+        { .name = "CanSuspendThenHibernate", .answer = "yes" },
+        { .name = "Inhibit" },
+};
+
+static const char* const answers[] = { "yes", "no", "challenge", "na" };
+
+#define MOCK_METHOD_COUNT (sizeof(methods) / sizeof(methods[0]))
+
+typedef struct MockCall {
+    MockMethod* method;
+    GDBusConnection* connection;
+    GDBusMethodInvocation* invocation;
+    GVariant* parameters;
+} MockCall;
+
+static gint64 mock_start;
+// The bus name was taken or lost, the loop quit on an error
+static bool mock_failed;
+
+static MockMethod* mock_method(const char* name) {
+    for (unsigned i = 0; i < MOCK_METHOD_COUNT; i++) {
+        if (strcmp(methods[i].name, name) == 0) {
+            return &methods[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Set the reply delay and injected error of one method, or of all of them for "*".
+ *
+ * @return 0 or -1 for an unknown method
+ */
+static int mock_configure(const char* name, guint delay, const char* error) {
+    for (unsigned i = 0; i < MOCK_METHOD_COUNT; i++) {
+        if (strcmp(name, "*") != 0 && strcmp(methods[i].name, name) != 0) {
+            continue;
+        }
+
+        methods[i].delay = delay;
+        free(methods[i].error);
+        methods[i].error = (error && error[0])? strdup(error) : NULL;
+
+        if (strcmp(name, "*") != 0) {
+            return 0;
+        }
+    }
+
+    return (strcmp(name, "*") == 0)? 0 : -1;
+}
+
+/**
+ * Set what one of the Can* methods, or all of them for "*", answers.
+ *
+ * @return 0 or -1 for an unknown method or answer
+ */
+static int mock_set_can(const char* name, const char* answer) {
+    const char* value = NULL;
+    for (unsigned i = 0; i < sizeof(answers) / sizeof(answers[0]); i++) {
+        if (strcmp(answers[i], answer) == 0) {
+            value = answers[i];
+        }
+    }
+    if (!value) {
+        return -1;
+    }
+
+    int r = (strcmp(name, "*") == 0)? 0 : -1;
+    for (unsigned i = 0; i < MOCK_METHOD_COUNT; i++) {
+        if (methods[i].answer && (strcmp(name, "*") == 0 || strcmp(methods[i].name, name) == 0)) {
+            methods[i].answer = value;
+            r = 0;
+        }
+    }
+
+    return r;
+}
+
+static void mock_emit(GDBusConnection* connection, const char* path, const char* interface, const char* signal,
+                      GVariant* parameters) {
+    g_dbus_connection_emit_signal(connection, NULL, path, interface, signal, parameters, NULL);
+}
+
+static void mock_reply(MockCall* call) {
+    GDBusMethodInvocation* invocation = call->invocation;
+    const char* name = call->method->name;
+
+    if (call->method->error) {
+        g_dbus_method_invocation_return_dbus_error(invocation, call->method->error, "Injected by the mock logind");
+    } else if (strcmp(name, "ListSessions") == 0) {
+        GVariantBuilder builder;
+        g_variant_builder_init(&builder, G_VARIANT_TYPE("a(susso)"));
+        g_variant_builder_add(&builder, "(susso)", MOCK_SESSION_ID, (guint32) getuid(), g_get_user_name(),
+                              MOCK_SEAT_ID, MOCK_SESSION_PATH);
+        g_dbus_method_invocation_return_value(invocation, g_variant_new("(a(susso))", &builder));
+    } else if (strcmp(name, "GetSession") == 0) {
+        const char* id;
+        g_variant_get(call->parameters, "(&s)", &id);
+        if (strcmp(id, MOCK_SESSION_ID) == 0) {
+            g_dbus_method_invocation_return_value(invocation, g_variant_new("(o)", MOCK_SESSION_PATH));
+        } else {
+            g_dbus_method_invocation_return_dbus_error(invocation, "org.freedesktop.login1.NoSuchSession", id);
+        }
+    } else if (strcmp(name, "GetSessionByPID") == 0) {
+        g_dbus_method_invocation_return_value(invocation, g_variant_new("(o)", MOCK_SESSION_PATH));
+    } else if (strcmp(name, "GetSeat") == 0) {
+        const char* id;
+        g_variant_get(call->parameters, "(&s)", &id);
+        if (strcmp(id, MOCK_SEAT_ID) == 0) {
+            g_dbus_method_invocation_return_value(invocation, g_variant_new("(o)", MOCK_SEAT_PATH));
+        } else {
+            g_dbus_method_invocation_return_dbus_error(invocation, "org.freedesktop.login1.NoSuchSeat", id);
+        }
+    } else if (call->method->answer) {
+        g_dbus_method_invocation_return_value(invocation, g_variant_new("(s)", call->method->answer));
+    } else if (strcmp(name, "LockSession") == 0 || strcmp(name, "Lock") == 0) {
+        mock_emit(call->connection, MOCK_SESSION_PATH, LOGIND_SESSION_INTERFACE, "Lock", NULL);
+        g_dbus_method_invocation_return_value(invocation, NULL);
+    } else if (strcmp(name, "Suspend") == 0 || strcmp(name, "Hibernate") == 0 ||
+               strcmp(name, "SuspendThenHibernate") == 0) {
+        mock_emit(call->connection, LOGIND_OBJECT_PATH, LOGIND_MANAGER_INTERFACE, "PrepareForSleep",
+                  g_variant_new("(b)", TRUE));
+        g_dbus_method_invocation_return_value(invocation, NULL);
+        // Resume right away
+        mock_emit(call->connection, LOGIND_OBJECT_PATH, LOGIND_MANAGER_INTERFACE, "PrepareForSleep",
+                  g_variant_new("(b)", FALSE));
+    } else if (strcmp(name, "PowerOff") == 0) {
+        mock_emit(call->connection, LOGIND_OBJECT_PATH, LOGIND_MANAGER_INTERFACE, "PrepareForShutdown",
+                  g_variant_new("(b)", TRUE));
+        g_dbus_method_invocation_return_value(invocation, NULL);
+    } else if (strcmp(name, "Inhibit") == 0) {
+        // Stands in for the FIFO logind hands out, the lock is never enforced
+        int fds[2];
+        if (pipe(fds) < 0) {
+            g_dbus_method_invocation_return_dbus_error(invocation, "org.freedesktop.DBus.Error.Failed", "pipe");
+        } else {
+            GUnixFDList* fd_list = g_unix_fd_list_new();
+            gint index = g_unix_fd_list_append(fd_list, fds[0], NULL);
+            g_dbus_method_invocation_return_value_with_unix_fd_list(invocation, g_variant_new("(h)", index), fd_list);
+            g_object_unref(fd_list);
+            close(fds[0]);
+            close(fds[1]);
+        }
+    }
+
+    g_variant_unref(call->parameters);
+    free(call);
+}
+
+static gboolean mock_reply_delayed(gpointer user_data) {
+    mock_reply((MockCall*) user_data);
+
+    return G_SOURCE_REMOVE;
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+static void mock_method_call(GDBusConnection *connection,
+                             const gchar *sender,
+                             const gchar *object_path,
+                             const gchar *interface_name,
+                             const gchar *method_name,
+                             GVariant *parameters,
+                             GDBusMethodInvocation *invocation,
+                             gpointer user_data) {
+#pragma clang diagnostic pop
+
+    if (strcmp(method_name, "Configure") == 0) {
+        const char* name;
+        guint32 delay;
+        const char* error;
+        g_variant_get(parameters, "(&su&s)", &name, &delay, &error);
+        if (mock_configure(name, delay, error) < 0) {
+            g_dbus_method_invocation_return_dbus_error(invocation, "org.freedesktop.DBus.Error.InvalidArgs", name);
+        } else {
+            g_dbus_method_invocation_return_value(invocation, NULL);
+        }
+        return;
+    }
+
+    if (strcmp(method_name, "SetCan") == 0) {
+        const char* name;
+        const char* answer;
+        g_variant_get(parameters, "(&s&s)", &name, &answer);
+        if (mock_set_can(name, answer) < 0) {
+            g_dbus_method_invocation_return_dbus_error(invocation, "org.freedesktop.DBus.Error.InvalidArgs", name);
+            return;
+        }
+
+        // Let the daemon know what logind allows changed
+        GVariantBuilder changed;
+        g_variant_builder_init(&changed, G_VARIANT_TYPE("a{sv}"));
+        g_variant_builder_add(&changed, "{sv}", "BlockInhibited", g_variant_new_string(""));
+        mock_emit(connection, LOGIND_OBJECT_PATH, "org.freedesktop.DBus.Properties", "PropertiesChanged",
+                  g_variant_new("(sa{sv}as)", LOGIND_MANAGER_INTERFACE, &changed, NULL));
+        g_dbus_method_invocation_return_value(invocation, NULL);
+        return;
+    }
+
+    MockMethod* method = mock_method(method_name);
+    if (!method) {
+        g_dbus_method_invocation_return_dbus_error(invocation, "org.freedesktop.DBus.Error.UnknownMethod", method_name);
+        return;
+    }
+
+    method->calls++;
+    printf("%10.3f ms %s #%u from %s\n", (g_get_monotonic_time() - mock_start) / 1000.0, method_name,
+           method->calls, sender);
+    fflush(stdout);
+
+    MockCall* call = malloc(sizeof(MockCall));
+    call->method = method;
+    call->connection = connection;
+    call->invocation = invocation;
+    call->parameters = g_variant_ref(parameters);
+
+    if (method->delay) {
+        g_timeout_add(method->delay, mock_reply_delayed, call);
+    } else {
+        mock_reply(call);
+    }
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+static GVariant* mock_get_property(GDBusConnection *connection,
+                                   const gchar *sender,
+                                   const gchar *object_path,
+                                   const gchar *interface_name,
+                                   const gchar *property_name,
+                                   GError **error,
+                                   gpointer user_data) {
+#pragma clang diagnostic pop
+
+    if (strcmp(property_name, "BlockInhibited") == 0) {
+        // Inhibitors are never enforced
+        return g_variant_new_string("");
+    } else if (strcmp(property_name, "ActiveSession") == 0) {
+        return g_variant_new("(so)", MOCK_SESSION_ID, MOCK_SESSION_PATH);
+    } else if (strcmp(property_name, "User") == 0) {
+        return g_variant_new("(uo)", (guint32) getuid(), MOCK_USER_PATH);
+    }
+
+    g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_PROPERTY, "%s", property_name);
+    return NULL;
+}
+
+static const GDBusInterfaceVTable mock_vtable = {
+        .method_call = mock_method_call,
+        .get_property = mock_get_property,
+};
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+static void mock_name_lost(GDBusConnection *connection, const gchar *name, gpointer user_data) {
+#pragma clang diagnostic pop
+
+    fprintf(stderr, "Unable to own %s\n", name);
+    mock_failed = true;
+    g_main_loop_quit((GMainLoop*) user_data);
+}
+
+/**
+ * Stop on SIGINT or SIGTERM, e.g. when dbus-run-session or the user ends the run, and exit cleanly.
+ */
+static gboolean mock_quit(gpointer user_data) {
+    g_main_loop_quit((GMainLoop*) user_data);
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+ * Parse METHOD=VALUE into the method name and the value.
+ */
+static const char* mock_split(char* option, char** value) {
+    char* separator = strchr(option, '=');
+    if (!separator) {
+        return NULL;
+    }
+
+    *separator = 0;
+    *value = separator + 1;
+
+    return option;
+}
+
+int main(int argc, char** argv) {
+    GError* error = NULL;
+    GDBusConnection* connection = NULL;
+    GDBusNodeInfo* info = NULL;
+    int r = 1;
+
+    mock_start = g_get_monotonic_time();
+
+    for (int i = 1; i < argc; i++) {
+        char* value;
+        const char* name = (i + 1 < argc)? mock_split(argv[i + 1], &value) : NULL;
+        MockMethod* method = (name && strcmp(name, "*") != 0)? mock_method(name) : NULL;
+
+        if (!name || (strcmp(name, "*") != 0 && !method)) {
+            fprintf(stderr, "Usage: %s [--delay METHOD=MS]... [--fail METHOD=ERROR]... [--can METHOD=ANSWER]...\n",
+                    argv[0]);
+            return 1;
+        }
+
+        if (strcmp(argv[i], "--delay") == 0) {
+            for (unsigned m = 0; m < MOCK_METHOD_COUNT; m++) {
+                if (!method || method == &methods[m]) {
+                    methods[m].delay = (guint) strtoul(value, NULL, 10);
+                }
+            }
+        } else if (strcmp(argv[i], "--fail") == 0) {
+            for (unsigned m = 0; m < MOCK_METHOD_COUNT; m++) {
+                if (!method || method == &methods[m]) {
+                    free(methods[m].error);
+                    methods[m].error = strdup(value);
+                }
+            }
+        } else if (strcmp(argv[i], "--can") == 0) {
+            if (mock_set_can(name, value) < 0) {
+                fprintf(stderr, "Invalid answer %s=%s, expected yes, no, challenge or na of a Can* method\n",
+                        name, value);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+        i++;
+    }
+
+    const char* address = getenv("GNOME3_LID_BUS_ADDRESS");
+    if (address) {
+        connection = g_dbus_connection_new_for_address_sync(
+                address,
+                G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT | G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                NULL,
+                NULL,
+                &error);
+    } else {
+        connection = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
+    }
+    if (!connection) {
+        fprintf(stderr, "Unable to connect to the bus: %s\n", error->message);
+        goto exit;
+    }
+
+    info = g_dbus_node_info_new_for_xml(introspection_xml, &error);
+    if (!info) {
+        fprintf(stderr, "Invalid introspection data: %s\n", error->message);
+        goto exit;
+    }
+
+    if (!g_dbus_connection_register_object(connection, LOGIND_OBJECT_PATH, info->interfaces[0], &mock_vtable,
+                                           NULL, NULL, &error) ||
+        !g_dbus_connection_register_object(connection, MOCK_SESSION_PATH, info->interfaces[1], &mock_vtable,
+                                           NULL, NULL, &error) ||
+        !g_dbus_connection_register_object(connection, MOCK_CONTROL_PATH, info->interfaces[2], &mock_vtable,
+                                           NULL, NULL, &error) ||
+        !g_dbus_connection_register_object(connection, MOCK_SEAT_PATH, info->interfaces[3], &mock_vtable,
+                                           NULL, NULL, &error)) {
+        fprintf(stderr, "Unable to export the mock objects: %s\n", error->message);
+        goto exit;
+    }
+
+    GMainLoop* loop = g_main_loop_new(NULL, FALSE);
+    const guint sigint = g_unix_signal_add(SIGINT, mock_quit, loop);
+    const guint sigterm = g_unix_signal_add(SIGTERM, mock_quit, loop);
+    g_bus_own_name_on_connection(connection, LOGIND_BUS_NAME, G_BUS_NAME_OWNER_FLAGS_NONE, NULL, mock_name_lost,
+                                 loop, NULL);
+    g_main_loop_run(loop);
+    g_source_remove(sigint);
+    g_source_remove(sigterm);
+    g_main_loop_unref(loop);
+    r = (mock_failed)? 1 : 0;
+
+    exit:
+    g_clear_error(&error);
+    if (info) {
+        g_dbus_node_info_unref(info);
+    }
+    if (connection) {
+        g_object_unref(connection);
+    }
+
+    return r;
+}
@@ -0,0 +1,27 @@
+#!/bin/sh
+# Run gnome3-lid against the mock logind on a private dbus-daemon.
+#
+# Usage: tools/mockLogind.sh BUILD_DIR [mock options]
+# e.g.   tools/mockLogind.sh build --delay Lock=500 --fail Suspend=org.freedesktop.login1.OperationInProgress
+set -e
+
+build="$1"
+shift
+
+exec dbus-run-session -- sh -c '
+    build="$1"
+    shift
+    "$build/gnome3-lid-mock-logind" "$@" &
+    # gdbus wait needs GLib 2.62, poll for up to 5 s instead
+    i=0
+    until gdbus introspect --session --dest org.freedesktop.login1 --object-path /org/freedesktop/login1 \
+            >/dev/null 2>&1; do
+        i=$((i + 1))
+        if [ "$i" -ge 50 ]; then
+            echo "The mock logind did not show up" >&2
+            exit 1
+        fi
+        sleep 0.1
+    done
+    GNOME3_LID_BUS_ADDRESS="$DBUS_SESSION_BUS_ADDRESS" exec "$build/gnome3-lid"
+' sh "$build" "$@"
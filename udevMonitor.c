@@ -0,0 +1,60 @@
+#include <stddef.h>
+#include <libudev.h>
+#include <asm/errno.h>
+
+#include "udevMonitor.h"
+
+/**
+ * Create a netlink monitor for processed udev events of one subsystem, optionally narrowed down to a tag.
+ * Both filters are evaluated by the kernel socket filter.
+ *
+ * @param udev
+ * @param subsystem
+ * @param tag Tag to match or NULL
+ * @param pMonitor
+ * @return The monitor fd or a negative error
+ */
+int udevMonitor_open(struct udev* udev, const char* subsystem, const char* tag, struct udev_monitor** pMonitor) {
+    int r;
+    struct udev_monitor* udev_monitor = udev_monitor_new_from_netlink(udev, "udev");
+    if (!udev_monitor) {
+        return -ENOMEM;
+    }
+
+    r = udev_monitor_set_receive_buffer_size(udev_monitor, 1024*1024);
+    if (r < 0) {
+        goto fail;
+    }
+
+    r = udev_monitor_filter_add_match_subsystem_devtype(udev_monitor, subsystem, NULL);
+    if (r < 0) {
+        goto fail;
+    }
+
+    if (tag) {
+        r = udev_monitor_filter_add_match_tag(udev_monitor, tag);
+        if (r < 0) {
+            goto fail;
+        }
+    }
+
+    r = udev_monitor_enable_receiving(udev_monitor);
+    if (r < 0) {
+        goto fail;
+    }
+
+    r = udev_monitor_get_fd(udev_monitor);
+    if (r < 0) {
+        goto fail;
+    }
+
+    *pMonitor = udev_monitor;
+
+    return r;
+
+    fail:
+
+    udev_monitor_unref(udev_monitor);
+
+    return r;
+}
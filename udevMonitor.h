@@ -0,0 +1,8 @@
+#ifndef SYSTEMD_LID_UDEV_MONITOR_H
+#define SYSTEMD_LID_UDEV_MONITOR_H
+
+#include <libudev.h>
+
+int udevMonitor_open(struct udev* udev, const char* subsystem, const char* tag, struct udev_monitor** pMonitor);
+
+#endif //SYSTEMD_LID_UDEV_MONITOR_H
@@ -0,0 +1,228 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <memory.h>
+#include <stdio.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <linux/uinput.h>
+
+#include "lidManager.h"
+#include "action.h"
+#include "settings.h"
+#include "latency.h"
+#include "recorder.h"
+#include "wake.h"
+
+/**
+ * Create a virtual pointer, whose motion counts as user activity for the compositor under X11 and Wayland alike.
+ *
+ * @return The uinput fd, negative errno if /dev/uinput is not writable
+ */
+static int wake_open_uinput(void) {
+    struct uinput_setup setup;
+
+    int fd = open(WAKE_UINPUT_PATH, O_WRONLY|O_NONBLOCK|O_CLOEXEC);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    // Classified as a mouse, so libinput hands it to the compositor
+    if (ioctl(fd, UI_SET_EVBIT, EV_KEY) < 0 ||
+        ioctl(fd, UI_SET_KEYBIT, BTN_LEFT) < 0 ||
+        ioctl(fd, UI_SET_EVBIT, EV_REL) < 0 ||
+        ioctl(fd, UI_SET_RELBIT, REL_X) < 0 ||
+        ioctl(fd, UI_SET_RELBIT, REL_Y) < 0) {
+        goto fail;
+    }
+
+    memset(&setup, 0, sizeof(setup));
+    setup.id.bustype = BUS_VIRTUAL;
+    strncpy(setup.name, WAKE_UINPUT_NAME, UINPUT_MAX_NAME_SIZE - 1);
+
+    if (ioctl(fd, UI_DEV_SETUP, &setup) < 0 || ioctl(fd, UI_DEV_CREATE) < 0) {
+        goto fail;
+    }
+
+    return fd;
+
+fail:
+    {
+        const int r = -errno;
+        close(fd);
+        return r;
+    }
+}
+
+/**
+ * Move the virtual pointer by one pixel and back.
+ *
+ * @param wake
+ * @return 0, or negative errno
+ */
+static int wake_nudge(Wake* wake) {
+    struct input_event events[4];
+    memset(events, 0, sizeof(events));
+
+    events[0].type = EV_REL;
+    events[0].code = REL_X;
+    events[0].value = 1;
+    events[1].type = EV_SYN;
+    events[1].code = SYN_REPORT;
+    events[2].type = EV_REL;
+    events[2].code = REL_X;
+    events[2].value = -1;
+    events[3].type = EV_SYN;
+    events[3].code = SYN_REPORT;
+
+    if (write(wake->uinput_fd, events, sizeof(events)) != (ssize_t) sizeof(events)) {
+        return -errno;
+    }
+
+    return 0;
+}
+
+static void wake_power_save_reply(GObject* source, GAsyncResult* res, gpointer user_data) {
+    GError* error = NULL;
+
+    GVariant* result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        g_error_free(error);
+        return;
+    }
+
+    Wake* wake = (Wake*) user_data;
+    if (result) {
+        g_variant_unref(result);
+    } else if (!wake->warned) {
+        fprintf(stderr, "Unable to wake the screen through %s: %s\n", WAKE_BUS_NAME, error->message);
+        wake->warned = true;
+    }
+    g_clear_error(&error);
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+static void wake_bus_ready(GObject* source, GAsyncResult* res, gpointer user_data) {
+#pragma clang diagnostic pop
+
+    GError* error = NULL;
+
+    GDBusConnection* connection = g_bus_get_finish(res, &error);
+    if (!connection) {
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            fprintf(stderr, "No session bus, the lid opening will not wake the screen: %s\n", error->message);
+        }
+        g_error_free(error);
+        return;
+    }
+
+    Wake* wake = (Wake*) user_data;
+    wake->connection = connection;
+}
+
+Wake* wake_new(const struct LidManager* manager) {
+    Wake* wake = malloc(sizeof(Wake));
+    if (!wake) {
+        return NULL;
+    }
+    memset(wake, 0, sizeof(Wake));
+
+    wake->manager = manager;
+    wake->connection = NULL;
+    wake->uinput_fd = -1;
+    wake->cancellable = g_cancellable_new();
+
+    return wake;
+}
+
+/**
+ * Connect to the session bus ahead of time, so opening the lid only costs sending one message. The system-wide
+ * instance has no access to the session bus, it nudges a virtual pointer instead, see wake_lid_closed().
+ *
+ * @param wake
+ */
+void wake_open(Wake* wake) {
+    if (wake->manager->seat) {
+        return;
+    }
+
+    g_bus_get(G_BUS_TYPE_SESSION, wake->cancellable, wake_bus_ready, wake);
+}
+
+/**
+ * Create the virtual pointer of the system-wide instance when the lid closes, only if opening it is meant to wake
+ * the screen. Creating it this early gives the compositor time to pick the new device up before the lid opens.
+ *
+ * @param wake
+ */
+void wake_lid_closed(Wake* wake) {
+    if (!wake->manager->seat || wake->uinput_fd >= 0 ||
+        settings_lid_open_action(wake->manager->settings) != ACTION_WAKE) {
+        return;
+    }
+
+    wake->uinput_fd = wake_open_uinput();
+    if (wake->uinput_fd < 0 && !wake->warned) {
+        fprintf(stderr, "Unable to create a virtual pointer, the lid opening will not wake the screen: %s\n",
+                strerror(-wake->uinput_fd));
+        wake->warned = true;
+    }
+}
+
+/**
+ * Turn the screen back on, which also brings up the lock screen, as soon as the lid opens and before anything else
+ * is done for the event. Like gnome-settings-daemon, the session instance leaves power saving through Mutter's
+ * display configuration. No reply is waited for.
+ *
+ * @param wake
+ * @param event Kernel timestamp of the lid opening
+ */
+void wake_lid_opened(Wake* wake, gint64 event) {
+    if (settings_lid_open_action(wake->manager->settings) != ACTION_WAKE) {
+        return;
+    }
+
+    if (wake->connection) {
+        g_dbus_connection_call(
+                wake->connection,
+                WAKE_BUS_NAME,
+                WAKE_OBJECT_PATH,
+                "org.freedesktop.DBus.Properties",
+                "Set",
+                g_variant_new("(ssv)", WAKE_INTERFACE, "PowerSaveMode", g_variant_new_int32(WAKE_POWER_SAVE_ON)),
+                NULL,
+                G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                -1,
+                wake->cancellable,
+                wake_power_save_reply,
+                wake);
+    } else if (wake->uinput_fd >= 0) {
+        const int r = wake_nudge(wake);
+        if (r < 0 && !wake->warned) {
+            fprintf(stderr, "Unable to wake the screen through " WAKE_UINPUT_PATH ": %s\n", strerror(-r));
+            wake->warned = true;
+        }
+    } else {
+        return;
+    }
+
+    const gint64 sent = latency_now();
+    latency_record(ACTION_WAKE, LATENCY_CALL, sent - event);
+    recorder_record(sent, RECORDER_CALL, ACTION_WAKE, -1);
+}
+
+void wake_close(Wake* wake) {
+    g_cancellable_cancel(wake->cancellable);
+    g_object_unref(wake->cancellable);
+
+    if (wake->connection) {
+        g_object_unref(wake->connection);
+    }
+    if (wake->uinput_fd >= 0) {
+        ioctl(wake->uinput_fd, UI_DEV_DESTROY);
+        close(wake->uinput_fd);
+    }
+
+    free(wake);
+}
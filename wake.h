@@ -0,0 +1,39 @@
+#ifndef SYSTEMD_LID_WAKE_H
+#define SYSTEMD_LID_WAKE_H
+
+#include <stdbool.h>
+#include <gio/gio.h>
+
+#include "lidManager.h"
+
+#define WAKE_UINPUT_PATH "/dev/uinput"
+#define WAKE_UINPUT_NAME "gnome3-lid wake"
+
+#define WAKE_BUS_NAME "org.gnome.Mutter.DisplayConfig"
+#define WAKE_OBJECT_PATH "/org/gnome/Mutter/DisplayConfig"
+#define WAKE_INTERFACE "org.gnome.Mutter.DisplayConfig"
+// PowerSaveMode value of DPMS on
+#define WAKE_POWER_SAVE_ON 0
+
+struct Wake;
+
+typedef struct Wake {
+    const struct LidManager* manager;
+
+    // Virtual pointer of the system-wide instance nudged on lid opening, negative errno until created
+    int uinput_fd;
+
+    // Session bus Mutter is on, NULL until connected and for the system-wide instance
+    GDBusConnection* connection;
+    GCancellable* cancellable;
+    // A failed wake-up was reported
+    bool warned;
+} Wake;
+
+Wake* wake_new(const struct LidManager* manager);
+void wake_open(Wake* wake);
+void wake_lid_closed(Wake* wake);
+void wake_lid_opened(Wake* wake, gint64 event);
+void wake_close(Wake* wake);
+
+#endif //SYSTEMD_LID_WAKE_H